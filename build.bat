@@ -14,8 +14,15 @@ cl %COMPILER_FLAGS% /O2 -Fe:haversine_generator ../src/haversine_generator.cpp /
 cl %COMPILER_FLAGS% /O2 -Fe:haversine           ../src/haversine.cpp           /link %LINKER_FLAGS%
 
 :: NOTE(achal): Repetition Tests
-cl %COMPILER_FLAGS% /O2 -Fe:rep_test_file_read   ../src/rep_test_file_read.cpp   /link %LINKER_FLAGS%
-cl %COMPILER_FLAGS% /O2 -Fe:rep_test_page_faults ../src/rep_test_page_faults.cpp /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_file_read    ../src/rep_test_file_read.cpp    /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_file_write   ../src/rep_test_file_write.cpp   /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_page_faults  ../src/rep_test_page_faults.cpp  /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_cache_sweep  ../src/rep_test_cache_sweep.cpp  /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_haversine    ../src/rep_test_haversine.cpp    /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_read_chunks  ../src/rep_test_read_chunks.cpp  /link %LINKER_FLAGS%
+cl %COMPILER_FLAGS% /O2 -Fe:rep_test_read_overlap ../src/rep_test_read_overlap.cpp /link %LINKER_FLAGS%
+
+:: NOTE(achal): page_residency is Linux only (/proc/self/pagemap, mincore), see build.sh
 
 echo Build complete.
 
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+mkdir -p build
+
+pushd build > /dev/null
+
+COMPILER_FLAGS="-g -pthread -Wall -Wextra -Werror -Wno-unused-parameter -Wno-unused-function -Wno-unused-variable -Wno-unused-but-set-variable -Wno-missing-field-initializers -I../ext -I../src"
+
+# NOTE(achal): The simulator
+# gcc $COMPILER_FLAGS -O0 -o porfavor ../src/main.c
+
+# NOTE(achal): The haversine stuff
+g++ $COMPILER_FLAGS -O2 -o haversine_generator ../src/haversine_generator.cpp || exit 1
+g++ $COMPILER_FLAGS -O2 -o haversine           ../src/haversine.cpp           || exit 1
+
+# NOTE(achal): Repetition Tests
+g++ $COMPILER_FLAGS -O2 -o rep_test_file_read    ../src/rep_test_file_read.cpp    || exit 1
+g++ $COMPILER_FLAGS -O2 -o rep_test_file_write   ../src/rep_test_file_write.cpp   || exit 1
+g++ $COMPILER_FLAGS -O2 -o rep_test_page_faults  ../src/rep_test_page_faults.cpp  || exit 1
+g++ $COMPILER_FLAGS -O2 -o rep_test_cache_sweep  ../src/rep_test_cache_sweep.cpp  || exit 1
+g++ $COMPILER_FLAGS -O2 -o rep_test_haversine    ../src/rep_test_haversine.cpp    || exit 1
+g++ $COMPILER_FLAGS -O2 -o rep_test_read_chunks  ../src/rep_test_read_chunks.cpp  || exit 1
+g++ $COMPILER_FLAGS -O2 -o rep_test_read_overlap ../src/rep_test_read_overlap.cpp || exit 1
+
+# NOTE(achal): Tools
+g++ $COMPILER_FLAGS -O2 -o page_residency ../src/page_residency.cpp || exit 1
+
+echo Build complete.
+
+popd > /dev/null
@@ -0,0 +1,359 @@
+#ifndef HAVERSINE_LIB_H
+#define HAVERSINE_LIB_H
+
+#include "haversine_common.h"
+
+#include <ctype.h>
+#include <float.h>
+
+// NOTE(achal): The stages of the haversine program (splitting the JSON into lines, parsing numbers,
+// building pairs, summing distances and validating them) as plain functions, so that rep_test_haversine
+// can time each of them on its own.
+
+static b32 StringsEqual(char *non_null_terminated, char *null_terminated, u32 len)
+{
+    char nt[32];
+    assert((u32)sizeof(nt) >= len+1);
+    memcpy(nt, non_null_terminated, len);
+    nt[len] = '\0';
+    return (b32)(strcmp(nt, null_terminated) == 0);
+}
+
+struct ParsedJSONLine
+{
+    f64 x0;
+    f64 y0;
+    f64 x1;
+    f64 y1;
+    f64 expected_average;
+};
+
+struct HaversinePair
+{
+    f64 x0, y0;
+    f64 x1, y1;
+};
+
+static inline b32 IsPairComplete(ParsedJSONLine *line)
+{
+    b32 result = (line->x0 != DBL_MAX) && (line->y0 != DBL_MAX) && (line->x1 != DBL_MAX) && (line->y1 != DBL_MAX);
+    return result;
+}
+
+static f64 ParseF64FromString(char *string, u32 *bytes_parsed)
+{
+    f64 result = 0;
+    char *ch = string;
+    
+    assert((*ch != ' ') && "My generator does not put spaces here");
+    
+    b32 is_negative = 0;
+    if (*ch == '-')
+    {
+        is_negative = 1;
+        ++ch;
+    }
+    
+    u32 pre_decimal_digit_count = 0;
+    {
+        char *temp = ch;
+        while (*ch != '.')
+            ++ch;
+        pre_decimal_digit_count = (u32)(ch-temp);
+    }
+    
+    f64 digit_scale = 1.0;
+    for (u32 i = 0; i < pre_decimal_digit_count; ++i)
+    {
+        char digit = *(ch - (i + 1));
+        assert(isdigit(digit));
+        
+        f64 digit_f64 = (f64)(digit - '0');
+        result += digit_scale*digit_f64;
+        
+        digit_scale *= 10.0;
+    }
+    
+    // move from the decimal to the first digit after decimal
+    ++ch;
+    
+    digit_scale = 0.1;
+    while ((*ch != ',') && (*ch != '}') && (*ch != '\n'))
+    {
+        assert(isdigit(*ch));
+        
+        f64 digit_f64 = (f64)(*ch - '0');
+        result += digit_scale*digit_f64;
+        
+        digit_scale *= 0.1;
+        ++ch;
+    }
+    
+    if (bytes_parsed)
+        *bytes_parsed = (u32)(ch-string);
+    
+    if (is_negative)
+        result *= -1.0;
+    
+    return result;
+}
+
+static b32 ParseJSONLine(char *ch, ParsedJSONLine *parsed_line)
+{
+    switch (*ch)
+    {
+        case '{':
+        case '\t':
+        case '"':
+        case ':':
+        case ' ':
+        case '[':
+        case ',':
+        case '}':
+        case ']':
+        {
+            ++ch;
+            return ParseJSONLine(ch, parsed_line);
+        } break;
+        
+        case '\n':
+        {
+            return 1;
+        } break;
+        
+        case 'p':
+        {
+            char pairs_str[] = "pairs";
+            u32 len = (u32)strlen(pairs_str);
+            if (StringsEqual(ch, pairs_str, len))
+            {
+                ch += len;
+                return ParseJSONLine(ch, parsed_line);
+            }
+            else
+            {
+                assert(0);
+                return 0;
+            }
+        } break;
+        
+        case 'x':
+        case 'y':
+        {
+            b32 is_x = (b32)(*ch == 'x');
+            ++ch;
+            
+            u64 idx;
+            {
+                char nt[4];
+                nt[0] = *ch;
+                nt[1] = '\0';
+                idx = ParseU64FromString(nt);
+            }
+            assert(idx <= 1);
+            
+            ++ch;
+            
+            char next_chars[] = "\": ";
+            u32 len = (u32)strlen(next_chars);
+            if (StringsEqual(ch, next_chars, len))
+            {
+                ch += len;
+                
+                u32 bytes_parsed;
+                f64 value = ParseF64FromString(ch, &bytes_parsed);
+                
+                if (is_x)
+                {
+                    if (idx == 0)
+                        parsed_line->x0 = value;
+                    else if (idx == 1)
+                        parsed_line->x1 = value;
+                    else
+                        assert(0);
+                }
+                else
+                {
+                    if (idx == 0)
+                        parsed_line->y0 = value;
+                    else if (idx == 1)
+                        parsed_line->y1 = value;
+                    else
+                        assert(0);
+                }
+                
+                ch += bytes_parsed;
+                
+                return ParseJSONLine(ch, parsed_line);
+            }
+            else
+            {
+                assert(0);
+                return 0;
+            }
+        } break;
+        
+        case 'e':
+        {
+            char expected_average_str[] = "expected_average";
+            u32 len = (u32)strlen(expected_average_str);
+            if (StringsEqual(ch, expected_average_str, len))
+            {
+                ch += len;
+                
+                char next_chars[] = "\": ";
+                len = (u32)strlen(next_chars);
+                if (StringsEqual(ch, next_chars, len))
+                {
+                    ch += len;
+                    
+                    u32 bytes_parsed;
+                    f64 value = ParseF64FromString(ch, &bytes_parsed);
+                    
+                    parsed_line->expected_average = value;
+                    ch += bytes_parsed;
+                    
+                    return ParseJSONLine(ch, parsed_line);
+                }
+                else
+                {
+                    assert(0);
+                    return 0;
+                }
+            }
+            else
+            {
+                assert(0);
+                return 0;
+            }
+        } break;
+        
+        default:
+        return 0;
+    }
+}
+
+// TODO(achal): This facilitates an incorrect way of parsing JSON and I will get rid of this
+// in the future when I introduce lexing-based parsing.
+// NOTE(achal): Reads until a newline character is encountered.
+static u64 ReadLine(char *line, u32 max_line_size, u8 *json_data)
+{
+    u32 char_count = 0;
+    u8 *src = json_data;
+    
+    while ((*src != '\r') && (*src != '\n'))
+    {
+        *line++ = *src++;
+        ++char_count;
+    }
+    
+    // NOTE(achal): Files written in text mode on Windows end their lines with "\r\n", on Linux with "\n".
+    if (*src == '\r')
+    {
+        src++; // eat up the '\r' character
+        ++char_count;
+    }
+    
+    // NOTE(achal): We still have to read the newline char at the end.
+    *line++ = *src++;
+    ++char_count;
+    
+    assert(char_count <= max_line_size);
+    return char_count;
+}
+
+static void ResetParsedJSONLine(ParsedJSONLine *parsed_line)
+{
+    parsed_line->x0 = DBL_MAX;
+    parsed_line->y0 = DBL_MAX;
+    parsed_line->x1 = DBL_MAX;
+    parsed_line->y1 = DBL_MAX;
+}
+
+// NOTE(achal): Only splits the input into lines, without parsing them. Returns the line count.
+static u64 TokenizeJSONLines(u8 *json_data, u64 json_size)
+{
+    char line[1024];
+    u64 line_count = 0;
+    
+    u64 json_byte_offset = 0;
+    while (json_byte_offset < json_size)
+    {
+        json_byte_offset += ReadLine(line, sizeof(line), json_data+json_byte_offset);
+        ++line_count;
+    }
+    
+    return line_count;
+}
+
+// NOTE(achal): Returns the number of pairs written to pairs, at most max_pair_count. expected_average gets
+// the average the generator wrote at the end of the file, DBL_MAX if there was none.
+static u64 ParseHaversinePairs(u8 *json_data, u64 json_size, HaversinePair *pairs, u64 max_pair_count, f64 *expected_average)
+{
+    char line[1024];
+    ParsedJSONLine parsed_line = { DBL_MAX, DBL_MAX, DBL_MAX, DBL_MAX, DBL_MAX };
+    
+    u64 parsed_pair_count = 0;
+    
+    memset(line, 0, sizeof(line));
+    u64 json_byte_offset = 0;
+    while (json_byte_offset < json_size)
+    {
+        u64 parsed_char_count = ReadLine(line, sizeof(line), json_data+json_byte_offset);
+        b32 success = ParseJSONLine(line, &parsed_line);
+        if (success)
+        {
+            if (IsPairComplete(&parsed_line) && (parsed_pair_count < max_pair_count))
+            {
+                pairs[parsed_pair_count++] = {parsed_line.x0, parsed_line.y0, parsed_line.x1, parsed_line.y1};
+            }
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Failed to parse line: %s\n", line);
+        }
+        
+        json_byte_offset += parsed_char_count;
+        
+        memset(line, 0, sizeof(line));
+        ResetParsedJSONLine(&parsed_line);
+    }
+    assert(json_byte_offset == json_size);
+    
+    if (expected_average)
+        *expected_average = parsed_line.expected_average;
+    
+    return parsed_pair_count;
+}
+
+static f64 SumHaversineDistances(HaversinePair *pairs, u64 pair_count)
+{
+    f64 sum = 0.0;
+    for (u64 i = 0; i < pair_count; ++i)
+    {
+        HaversinePair *pair = pairs + i;
+        sum += ReferenceHaversine(pair->x0, pair->y0, pair->x1, pair->y1, g_EarthRadius);
+    }
+    
+    return sum;
+}
+
+// NOTE(achal): Checks every distance against the reference answers the generator wrote. Returns the
+// number of mismatches.
+static u64 ValidateHaversineDistances(HaversinePair *pairs, u64 pair_count, f64 *answers, f64 threshold)
+{
+    u64 mismatch_count = 0;
+    for (u64 i = 0; i < pair_count; ++i)
+    {
+        HaversinePair *pair = pairs + i;
+        f64 haversine_distance = ReferenceHaversine(pair->x0, pair->y0, pair->x1, pair->y1, g_EarthRadius);
+        
+        f64 abs_diff = fabs(answers[i]-haversine_distance);
+        if (abs_diff > threshold)
+            ++mismatch_count;
+    }
+    
+    return mismatch_count;
+}
+
+#endif // HAVERSINE_LIB_H
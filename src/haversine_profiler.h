@@ -3,6 +3,32 @@
 
 #include "platform_metrics.h"
 
+#include <math.h>
+#include <string.h>
+
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+#include "perf_counters.h"
+#endif
+
+#ifdef ENABLE_SAMPLING_PROFILER
+#ifdef ENABLE_PROFILER
+#error ENABLE_SAMPLING_PROFILER replaces the instrumenting profiler, define only one of them
+#endif
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/time.h>
+#else
+#error ENABLE_SAMPLING_PROFILER needs SIGPROF, which is only available on Linux
+#endif
+
+#ifndef PROFILER_SAMPLE_INTERVAL_US
+#define PROFILER_SAMPLE_INTERVAL_US 1000
+#endif
+
+#define PROFILER_MAX_SAMPLED_DEPTH 64
+#endif
+
 #ifndef READ_SCOPE_TIMER
 #define READ_SCOPE_TIMER ReadCPUTimer
 #endif
@@ -29,14 +55,156 @@ static u64 EstimateScopeTimerFrequency(u64 ms_to_wait)
     return scope_timer_freq;
 }
 
+// NOTE(achal): The scope timer is one of the platform timers unless someone plugs in their own, and
+// their frequencies are already known (and cached) by platform_timer.h.
+static u64 GetScopeTimerFrequency()
+{
+    static u64 scope_timer_freq = 0;
+    if (!scope_timer_freq)
+    {
+        if (READ_SCOPE_TIMER == ReadCPUTimer)
+            scope_timer_freq = GetCPUTimerFrequency();
+        else if (READ_SCOPE_TIMER == ReadOSTimer)
+            scope_timer_freq = GetOSTimerFrequency();
+        else
+            scope_timer_freq = EstimateScopeTimerFrequency(20);
+    }
+    
+    return scope_timer_freq;
+}
+
+#ifdef ENABLE_PROFILER_HISTOGRAMS
+// NOTE(achal): Log-linear (HDR-style) histogram of per-hit durations: every power of two is split
+// into 2^PROFILER_HISTOGRAM_SUB_BUCKET_BITS linear sub-buckets, so the relative error of any
+// reported percentile is bounded (12.5% with 3 bits) no matter how long the hit took.
+#define PROFILER_HISTOGRAM_SUB_BUCKET_BITS 3
+#define PROFILER_HISTOGRAM_SUB_BUCKET_COUNT (1 << PROFILER_HISTOGRAM_SUB_BUCKET_BITS)
+#define PROFILER_HISTOGRAM_BUCKET_COUNT ((64 - PROFILER_HISTOGRAM_SUB_BUCKET_BITS + 1)*PROFILER_HISTOGRAM_SUB_BUCKET_COUNT)
+
+struct ProfileHistogram
+{
+    u64 max;
+    u64 counts[PROFILER_HISTOGRAM_BUCKET_COUNT];
+};
+
+static inline u32 MostSignificantBitIndex(u64 value)
+{
+#ifdef _MSC_VER
+    unsigned long result;
+    _BitScanReverse64(&result, value);
+    return (u32)result;
+#else
+    return 63 - (u32)__builtin_clzll(value);
+#endif
+}
+
+static inline u32 GetHistogramBucketIndex(u64 value)
+{
+    // NOTE(achal): Values below the sub-bucket count get a bucket of their own.
+    if (value < PROFILER_HISTOGRAM_SUB_BUCKET_COUNT)
+        return (u32)value;
+    
+    u32 shift = MostSignificantBitIndex(value) - PROFILER_HISTOGRAM_SUB_BUCKET_BITS;
+    u32 sub_bucket = (u32)(value >> shift) & (PROFILER_HISTOGRAM_SUB_BUCKET_COUNT - 1);
+    u32 result = (shift + 1)*PROFILER_HISTOGRAM_SUB_BUCKET_COUNT + sub_bucket;
+    return result;
+}
+
+// NOTE(achal): Midpoint of the range of values that map to this bucket.
+static inline f64 GetHistogramBucketValue(u32 bucket_index)
+{
+    if (bucket_index < PROFILER_HISTOGRAM_SUB_BUCKET_COUNT)
+        return (f64)bucket_index;
+    
+    u32 shift = bucket_index/PROFILER_HISTOGRAM_SUB_BUCKET_COUNT - 1;
+    u64 sub_bucket = bucket_index%PROFILER_HISTOGRAM_SUB_BUCKET_COUNT;
+    u64 lower = (PROFILER_HISTOGRAM_SUB_BUCKET_COUNT | sub_bucket) << shift;
+    u64 width = 1ull << shift;
+    
+    f64 result = (f64)lower + 0.5*(f64)(width - 1);
+    return result;
+}
+
+static inline void RecordHistogramValue(ProfileHistogram *histogram, u64 value)
+{
+    ++histogram->counts[GetHistogramBucketIndex(value)];
+    if (value > histogram->max)
+        histogram->max = value;
+}
+
+static f64 GetHistogramPercentile(ProfileHistogram *histogram, u64 total_count, f64 percentile)
+{
+    u64 target = (u64)ceil(percentile*(f64)total_count);
+    if (target == 0)
+        target = 1;
+    
+    u64 count = 0;
+    for (u32 i = 0; i < PROFILER_HISTOGRAM_BUCKET_COUNT; ++i)
+    {
+        count += histogram->counts[i];
+        if (count >= target)
+        {
+            f64 result = GetHistogramBucketValue(i);
+            if (result > (f64)histogram->max)
+                result = (f64)histogram->max;
+            return result;
+        }
+    }
+    
+    return (f64)histogram->max;
+}
+#endif
+
 struct ProfileAnchor
 {
     u64 elapsed_inclusive;
     u64 elapsed_exclusive;
     u64 hit_count;
-    u64 bytes_processed;
-    char *label;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 item_count;
+    char const *label;
+    
+    // NOTE(achal): Needed to subtract the profiler's own overhead, see CalibrateProfilerOverhead.
+    u64 child_hit_count;
+    u64 nested_hit_count;
+    
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+    u64 counters_inclusive[PerfCounter_Count];
+    u64 counters_exclusive[PerfCounter_Count];
+#endif
+    
+#ifdef ENABLE_PROFILER_HISTOGRAMS
+    ProfileHistogram histogram;
+#endif
+    
+#ifdef ENABLE_PROFILER_CPU_TIME
+    u64 cpu_time_inclusive;
+    u64 voluntary_switches_inclusive;
+    u64 involuntary_switches_inclusive;
+#endif
+    
+#ifdef ENABLE_PROFILER_MEMORY
+    u64 minor_faults_inclusive;
+    u64 major_faults_inclusive;
+    s64 rss_growth_inclusive;
+#endif
+};
+
+static inline u64 GetBytesProcessed(ProfileAnchor *anchor)
+{
+    u64 result = anchor->bytes_read + anchor->bytes_written;
+    return result;
+}
+
+#ifdef ENABLE_SAMPLING_PROFILER
+struct ProfileSampleAnchor
+{
+    char const *label;
+    u64 samples_exclusive;
+    u64 samples_inclusive;
 };
+#endif
 
 struct Profiler
 {
@@ -44,13 +212,34 @@ struct Profiler
     
 #ifdef ENABLE_PROFILER
     u32 active_anchor_id;
+    u64 total_hit_count;
     ProfileAnchor anchors[1+31];
+    
+    // NOTE(achal): Timer ticks per ProfileScope which end up inside the anchor's own measurement and
+    // the ones which end up in whatever anchor encloses it, respectively.
+    f64 scope_overhead;
+    f64 parent_overhead;
+#elif defined(ENABLE_SAMPLING_PROFILER)
+    // NOTE(achal): Written by the scopes and read by the SIGPROF handler, which interrupts this very
+    // thread, so volatile is enough to keep the compiler from reordering or caching them.
+    u32 volatile active_anchor_id;
+    u32 volatile anchor_stack_depth;
+    u32 volatile anchor_stack[PROFILER_MAX_SAMPLED_DEPTH];
+    
+    u64 sample_count;
+    ProfileSampleAnchor anchors[1+31];
 #endif
 };
 static Profiler g_Profiler;
 
-static inline void BeginProfiler() { g_Profiler.elapsed = READ_SCOPE_TIMER(); }
-static inline void EndProfiler() { g_Profiler.elapsed = READ_SCOPE_TIMER() - g_Profiler.elapsed; }
+static inline f64 GetPercentage(u64 part, u64 whole)
+{
+    f64 result = ((f64)part*100.0)/(f64)whole;
+    return result;
+}
+
+#define CONCAT_IMPL(a, b) a##b
+#define CONCAT(a, b) CONCAT_IMPL(a, b)
 
 #ifdef ENABLE_PROFILER
 struct ProfileScope
@@ -58,10 +247,35 @@ struct ProfileScope
     u64 tsc_begin;
     u32 anchor_id;
     u32 parent_anchor_id;
-    char *label;
+    char const *label;
     u64 old_elapsed_inclusive;
+    u64 old_nested_hit_count;
+    u64 total_hit_count_begin;
+    
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+    PerfCounterValues counters_begin;
+    u64 old_counters_inclusive[PerfCounter_Count];
+#endif
+    
+#ifdef ENABLE_PROFILER_CPU_TIME
+    u64 cpu_time_begin;
+    u64 voluntary_switches_begin;
+    u64 involuntary_switches_begin;
+    u64 old_cpu_time_inclusive;
+    u64 old_voluntary_switches_inclusive;
+    u64 old_involuntary_switches_inclusive;
+#endif
+    
+#ifdef ENABLE_PROFILER_MEMORY
+    u64 minor_faults_begin;
+    u64 major_faults_begin;
+    u64 rss_begin;
+    u64 old_minor_faults_inclusive;
+    u64 old_major_faults_inclusive;
+    s64 old_rss_growth_inclusive;
+#endif
     
-    ProfileScope(char *label_, u32 id, u64 bytes_processed)
+    ProfileScope(char const *label_, u32 id, u64 bytes_read, u64 bytes_written, u64 item_count)
     {
         assert((id != 0) && "0 is reserved for the invalid anchor");
         assert(id < ArrayCount(g_Profiler.anchors));
@@ -71,11 +285,39 @@ struct ProfileScope
         label = label_;
         
         ProfileAnchor *anchor = g_Profiler.anchors + anchor_id;
-        anchor->bytes_processed += bytes_processed;
+        anchor->bytes_read += bytes_read;
+        anchor->bytes_written += bytes_written;
+        anchor->item_count += item_count;
         old_elapsed_inclusive = anchor->elapsed_inclusive;
+        old_nested_hit_count = anchor->nested_hit_count;
+        total_hit_count_begin = g_Profiler.total_hit_count;
         
         g_Profiler.active_anchor_id = id;
         
+#ifdef ENABLE_PROFILER_MEMORY
+        // NOTE(achal): Outermost, these are syscalls (and a parse of /proc/self/statm) which shouldn't count
+        // towards the scope's CPU time or counters.
+        old_minor_faults_inclusive = anchor->minor_faults_inclusive;
+        old_major_faults_inclusive = anchor->major_faults_inclusive;
+        old_rss_growth_inclusive = anchor->rss_growth_inclusive;
+        rss_begin = ReadOSResidentSetSize();
+        ReadOSThreadPageFaultCounts(&minor_faults_begin, &major_faults_begin);
+#endif
+        
+#ifdef ENABLE_PROFILER_CPU_TIME
+        old_cpu_time_inclusive = anchor->cpu_time_inclusive;
+        old_voluntary_switches_inclusive = anchor->voluntary_switches_inclusive;
+        old_involuntary_switches_inclusive = anchor->involuntary_switches_inclusive;
+        ReadOSThreadContextSwitchCounts(&voluntary_switches_begin, &involuntary_switches_begin);
+        cpu_time_begin = ReadOSThreadCPUTime();
+#endif
+        
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+        // NOTE(achal): Innermost, next to the timer read, so that the counts don't include the other reads.
+        memcpy(old_counters_inclusive, anchor->counters_inclusive, sizeof(old_counters_inclusive));
+        ReadPerfCounters(&counters_begin, 1);
+#endif
+        
         tsc_begin = READ_SCOPE_TIMER();
     }
     
@@ -86,6 +328,43 @@ struct ProfileScope
         ProfileAnchor *anchor = g_Profiler.anchors + anchor_id;
         ProfileAnchor *parent_anchor = g_Profiler.anchors + parent_anchor_id;
         
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+        PerfCounterValues counters_end;
+        ReadPerfCounters(&counters_end, counters_begin.is_from_rdpmc);
+        
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+        {
+            u64 delta = counters_end.values[i] - counters_begin.values[i];
+            anchor->counters_inclusive[i] = old_counters_inclusive[i] + delta;
+            anchor->counters_exclusive[i] += delta;
+            parent_anchor->counters_exclusive[i] -= delta;
+        }
+#endif
+        
+#ifdef ENABLE_PROFILER_CPU_TIME
+        {
+            u64 cpu_time_end = ReadOSThreadCPUTime();
+            u64 voluntary_switches_end, involuntary_switches_end;
+            ReadOSThreadContextSwitchCounts(&voluntary_switches_end, &involuntary_switches_end);
+            
+            anchor->cpu_time_inclusive = old_cpu_time_inclusive + (cpu_time_end - cpu_time_begin);
+            anchor->voluntary_switches_inclusive = old_voluntary_switches_inclusive + (voluntary_switches_end - voluntary_switches_begin);
+            anchor->involuntary_switches_inclusive = old_involuntary_switches_inclusive + (involuntary_switches_end - involuntary_switches_begin);
+        }
+#endif
+        
+#ifdef ENABLE_PROFILER_MEMORY
+        {
+            u64 minor_faults_end, major_faults_end;
+            ReadOSThreadPageFaultCounts(&minor_faults_end, &major_faults_end);
+            u64 rss_end = ReadOSResidentSetSize();
+            
+            anchor->minor_faults_inclusive = old_minor_faults_inclusive + (minor_faults_end - minor_faults_begin);
+            anchor->major_faults_inclusive = old_major_faults_inclusive + (major_faults_end - major_faults_begin);
+            anchor->rss_growth_inclusive = old_rss_growth_inclusive + ((s64)rss_end - (s64)rss_begin);
+        }
+#endif
+        
         if (anchor->hit_count == 0)
             anchor->label = label;
         
@@ -94,65 +373,390 @@ struct ProfileScope
         anchor->elapsed_exclusive += elapsed;
         parent_anchor->elapsed_exclusive -= elapsed;
         
+#ifdef ENABLE_PROFILER_HISTOGRAMS
+        RecordHistogramValue(&anchor->histogram, elapsed);
+#endif
+        
+        anchor->nested_hit_count = old_nested_hit_count + (g_Profiler.total_hit_count - total_hit_count_begin);
+        ++parent_anchor->child_hit_count;
+        ++g_Profiler.total_hit_count;
+        
         g_Profiler.active_anchor_id = parent_anchor_id;
     }
 };
 
-static inline f64 GetPercentage(u64 part, u64 whole)
+// NOTE(achal): Every scope pays for two timer reads and the bookkeeping around them. Part of that
+// lands between the two timer reads, and is attributed to the scope's own anchor, the rest is
+// attributed to the enclosing anchor. For small scopes with a lot of hits this is no longer noise,
+// so we measure both parts once, with an empty scope, and subtract them per hit when printing.
+static void CalibrateProfilerOverhead()
 {
-    f64 result = ((f64)part*100.0)/(f64)whole;
+    u32 const batch_count = 16;
+    u32 const iterations_per_batch = 1024;
+    
+    f64 min_scope_overhead = 0.0;
+    f64 min_total_overhead = 0.0;
+    for (u32 batch = 0; batch < batch_count; ++batch)
+    {
+        u64 begin = READ_SCOPE_TIMER();
+        for (u32 i = 0; i < iterations_per_batch; ++i)
+        {
+            ProfileScope scope("Calibration", 1, 0, 0, 0);
+        }
+        u64 total_elapsed = READ_SCOPE_TIMER() - begin;
+        
+        f64 scope_overhead = (f64)g_Profiler.anchors[1].elapsed_exclusive/(f64)iterations_per_batch;
+        f64 total_overhead = (f64)total_elapsed/(f64)iterations_per_batch;
+        
+        if ((batch == 0) || (scope_overhead < min_scope_overhead))
+            min_scope_overhead = scope_overhead;
+        if ((batch == 0) || (total_overhead < min_total_overhead))
+            min_total_overhead = total_overhead;
+        
+        memset(g_Profiler.anchors, 0, sizeof(g_Profiler.anchors));
+        g_Profiler.active_anchor_id = 0;
+        g_Profiler.total_hit_count = 0;
+    }
+    
+    g_Profiler.scope_overhead = min_scope_overhead;
+    g_Profiler.parent_overhead = 0.0;
+    if (min_total_overhead > min_scope_overhead)
+        g_Profiler.parent_overhead = min_total_overhead - min_scope_overhead;
+}
+
+static inline u64 SubtractOverhead(u64 elapsed, f64 overhead)
+{
+    u64 result = 0;
+    if ((f64)elapsed > overhead)
+        result = elapsed - (u64)overhead;
     return result;
 }
 
-#define CONCAT_IMPL(a, b) a##b
-#define CONCAT(a, b) CONCAT_IMPL(a, b)
-#define PROFILE_SCOPE_BANDWIDTH(label, bytes) ProfileScope CONCAT(_prof_scope_, __LINE__)(label, __COUNTER__+1, bytes)
+#define PROFILE_SCOPE_DATA(label, bytes_read, bytes_written, item_count) ProfileScope CONCAT(_prof_scope_, __LINE__)(label, __COUNTER__+1, bytes_read, bytes_written, item_count)
+#define PROFILE_SCOPE_BANDWIDTH(label, bytes) PROFILE_SCOPE_DATA(label, bytes, 0, 0)
 #define PROFILE_FUNCTION_BANDWIDTH(bytes) PROFILE_SCOPE_BANDWIDTH(__func__, bytes)
 #define PROFILE_SCOPE(label) PROFILE_SCOPE_BANDWIDTH(label, 0)
 #define PROFILE_FUNCTION PROFILE_SCOPE(__func__)
 
 #define PROFILER_END_OF_COMPILATION_UNIT static_assert(ArrayCount(g_Profiler.anchors) >= __COUNTER__+1, "Ran out of `ProfileAnchor`s")
+#elif defined(ENABLE_SAMPLING_PROFILER)
+// NOTE(achal): The sampling counterpart of ProfileScope. No timer reads, it only keeps track of
+// which anchors are active so that the SIGPROF handler can attribute the sample. Cheap enough to
+// leave coarse anchors compiled in for production runs.
+struct ProfileSampleScope
+{
+    u32 parent_anchor_id;
+    
+    ProfileSampleScope(char const *label, u32 id)
+    {
+        assert((id != 0) && "0 is reserved for the invalid anchor");
+        assert(id < ArrayCount(g_Profiler.anchors));
+        
+        ProfileSampleAnchor *anchor = g_Profiler.anchors + id;
+        if (!anchor->label)
+            anchor->label = label;
+        
+        parent_anchor_id = g_Profiler.active_anchor_id;
+        
+        u32 depth = g_Profiler.anchor_stack_depth;
+        if (depth < PROFILER_MAX_SAMPLED_DEPTH)
+            g_Profiler.anchor_stack[depth] = id;
+        g_Profiler.anchor_stack_depth = depth + 1;
+        
+        g_Profiler.active_anchor_id = id;
+    }
+    
+    ~ProfileSampleScope()
+    {
+        g_Profiler.active_anchor_id = parent_anchor_id;
+        g_Profiler.anchor_stack_depth = g_Profiler.anchor_stack_depth - 1;
+    }
+};
+
+static void ProfilerSampleHandler(int signal_number)
+{
+    u32 active_anchor_id = g_Profiler.active_anchor_id;
+    ++g_Profiler.anchors[active_anchor_id].samples_exclusive;
+    
+    // NOTE(achal): Walk the call path, an anchor which is on it more than once (recursion) still
+    // only gets the sample once.
+    u64 seen_mask = 0;
+    u32 depth = g_Profiler.anchor_stack_depth;
+    if (depth > PROFILER_MAX_SAMPLED_DEPTH)
+        depth = PROFILER_MAX_SAMPLED_DEPTH;
+    
+    for (u32 i = 0; i < depth; ++i)
+    {
+        u32 anchor_id = g_Profiler.anchor_stack[i];
+        if (!(seen_mask & (1ull << anchor_id)))
+        {
+            seen_mask |= (1ull << anchor_id);
+            ++g_Profiler.anchors[anchor_id].samples_inclusive;
+        }
+    }
+    
+    ++g_Profiler.sample_count;
+}
+
+static void SetSampleTimer(u64 interval_us)
+{
+    itimerval timer = {};
+    timer.it_interval.tv_sec = (time_t)(interval_us/1000000);
+    timer.it_interval.tv_usec = (suseconds_t)(interval_us%1000000);
+    timer.it_value = timer.it_interval;
+    
+    int retval = setitimer(ITIMER_PROF, &timer, 0);
+    assert(retval == 0);
+}
+
+static void BeginSampling()
+{
+    static_assert(ArrayCount(g_Profiler.anchors) <= 64, "Samples track the call path in a 64-bit mask");
+    
+    struct sigaction action = {};
+    action.sa_handler = ProfilerSampleHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    
+    int retval = sigaction(SIGPROF, &action, 0);
+    assert(retval == 0);
+    
+    SetSampleTimer(PROFILER_SAMPLE_INTERVAL_US);
+}
+
+static void EndSampling()
+{
+    SetSampleTimer(0);
+    signal(SIGPROF, SIG_IGN);
+}
+
+#define PROFILE_SCOPE_DATA(label, bytes_read, bytes_written, item_count) ProfileSampleScope CONCAT(_prof_scope_, __LINE__)(label, __COUNTER__+1)
+#define PROFILE_SCOPE_BANDWIDTH(label, bytes) PROFILE_SCOPE_DATA(label, bytes, 0, 0)
+#define PROFILE_FUNCTION_BANDWIDTH(bytes) PROFILE_SCOPE_BANDWIDTH(__func__, bytes)
+#define PROFILE_SCOPE(label) PROFILE_SCOPE_BANDWIDTH(label, 0)
+#define PROFILE_FUNCTION PROFILE_SCOPE(__func__)
+
+#define PROFILER_END_OF_COMPILATION_UNIT static_assert(ArrayCount(g_Profiler.anchors) >= __COUNTER__+1, "Ran out of `ProfileSampleAnchor`s")
 #else
 
+#define PROFILE_SCOPE_DATA(label, bytes_read, bytes_written, item_count)
 #define PROFILE_SCOPE_BANDWIDTH(label, bytes)
 #define PROFILE_FUNCTION_BANDWIDTH(bytes)
 #define PROFILE_SCOPE
 #define PROFILE_FUNCTION
 
 #define PROFILER_END_OF_COMPILATION_UNIT
-#endif // ENABLE_PROFILER
+#endif // ENABLE_PROFILER, ENABLE_SAMPLING_PROFILER
+
+static inline void BeginProfiler()
+{
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+    if (!InitializePerfCounters())
+        fprintf(stderr, "WARNING: Hardware performance counters are unavailable\n");
+#endif
+    
+#ifdef ENABLE_PROFILER
+    CalibrateProfilerOverhead();
+#endif
+    
+#ifdef ENABLE_SAMPLING_PROFILER
+    BeginSampling();
+#endif
+    
+    g_Profiler.elapsed = READ_SCOPE_TIMER();
+}
+
+static inline void EndProfiler()
+{
+    g_Profiler.elapsed = READ_SCOPE_TIMER() - g_Profiler.elapsed;
+    
+#ifdef ENABLE_SAMPLING_PROFILER
+    EndSampling();
+#endif
+    
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+    ShutdownPerfCounters();
+#endif
+}
+
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+// NOTE(achal): Inclusive counts, so that they line up with the GB/s figure which is also computed
+// from the inclusive time.
+static void PrintAnchorPerfCounters(ProfileAnchor *anchor)
+{
+    u64 *counters = anchor->counters_inclusive;
+    if (!counters[PerfCounter_Cycles])
+        return;
+    
+    f64 ipc = (f64)counters[PerfCounter_Instructions]/(f64)counters[PerfCounter_Cycles];
+    fprintf(stdout, "\t\tIPC: %.3f", ipc);
+    
+    for (u32 i = PerfCounter_L1DMisses; i < PerfCounter_Count; ++i)
+    {
+        if (!IsPerfCounterAvailable(i))
+            continue;
+        
+        fprintf(stdout, ", %s: %llu", g_PerfCounterNames[i], counters[i]);
+        if (GetBytesProcessed(anchor))
+            fprintf(stdout, " (%.4f/byte)", (f64)counters[i]/(f64)GetBytesProcessed(anchor));
+    }
+    fprintf(stdout, "\n");
+}
+#endif
+
+#ifdef ENABLE_PROFILER_HISTOGRAMS
+// NOTE(achal): Per-hit inclusive durations, with the calibrated in-scope overhead taken off like
+// everywhere else in the profile. Only worth printing for anchors which are hit more than once.
+static void PrintAnchorHistogram(ProfileAnchor *anchor, u64 cpu_freq)
+{
+    if (anchor->hit_count < 2)
+        return;
+    
+    f64 percentiles[] = { 0.5, 0.9, 0.99 };
+    char const *percentile_names[] = { "p50", "p90", "p99" };
+    
+    f64 us_per_tick = 1000000.0/(f64)cpu_freq;
+    
+    fprintf(stdout, "\t\t");
+    for (u32 i = 0; i < ArrayCount(percentiles); ++i)
+    {
+        f64 value = GetHistogramPercentile(&anchor->histogram, anchor->hit_count, percentiles[i]);
+        value = (value > g_Profiler.scope_overhead) ? (value - g_Profiler.scope_overhead) : 0.0;
+        fprintf(stdout, "%s: %.3fus, ", percentile_names[i], value*us_per_tick);
+    }
+    
+    f64 max = (f64)SubtractOverhead(anchor->histogram.max, g_Profiler.scope_overhead);
+    fprintf(stdout, "max: %.3fus\n", max*us_per_tick);
+}
+#endif
+
+#ifdef ENABLE_PROFILER_CPU_TIME
+// NOTE(achal): Whatever part of the wall time the thread did not spend on a CPU it spent waiting:
+// on I/O, on page faults that had to go to disk, or on the run queue (involuntary switches).
+static void PrintAnchorCPUTime(ProfileAnchor *anchor, u64 elapsed_inclusive, u64 cpu_freq)
+{
+    f64 wall_ms = 1000.0*(f64)elapsed_inclusive/(f64)cpu_freq;
+    f64 cpu_ms = (f64)anchor->cpu_time_inclusive/1000000.0;
+    f64 off_cpu_ms = (wall_ms > cpu_ms) ? (wall_ms - cpu_ms) : 0.0;
+    f64 off_cpu_percent = (wall_ms > 0.0) ? (100.0*off_cpu_ms/wall_ms) : 0.0;
+    
+    fprintf(stdout, "\t\tCPU: %.3fms, Off-CPU: %.3fms (%.3f%%), Context switches: %llu voluntary, %llu involuntary\n", cpu_ms, off_cpu_ms, off_cpu_percent, anchor->voluntary_switches_inclusive, anchor->involuntary_switches_inclusive);
+}
+#endif
+
+#ifdef ENABLE_PROFILER_MEMORY
+static void PrintAnchorMemory(ProfileAnchor *anchor)
+{
+    u64 fault_count = anchor->minor_faults_inclusive + anchor->major_faults_inclusive;
+    fprintf(stdout, "\t\tPage faults: %llu minor, %llu major", anchor->minor_faults_inclusive, anchor->major_faults_inclusive);
+    
+    u64 bytes_processed = GetBytesProcessed(anchor);
+    if (fault_count && bytes_processed)
+        fprintf(stdout, " (%.4f KBs/PageFault)", (f64)bytes_processed/((f64)fault_count*1024.0));
+    
+    fprintf(stdout, ", RSS growth: %+.3f MB\n", (f64)anchor->rss_growth_inclusive/(1024.0*1024.0));
+}
+#endif
 
 static void PrintPerformanceProfile()
 {
     fprintf(stdout, "\nPerformance Profile:\n");
     
-    u64 cpu_freq = EstimateScopeTimerFrequency(100);
+    u64 cpu_freq = GetScopeTimerFrequency();
     u64 total_time = g_Profiler.elapsed;
     f64 total_ms = ((f64)total_time/(f64)cpu_freq)*1000.0;
     
     fprintf(stdout, "Total time: %llu | %.4fms (CPU Frequency Estimate: %llu)\n", total_time, total_ms, cpu_freq);
+    if ((READ_SCOPE_TIMER == ReadCPUTimer) && g_CPUTimer.source)
+    {
+        fprintf(stdout, "CPU Timer: %s%s\n", g_CPUTimer.source, g_CPUTimer.is_invariant ? "" : " (WARNING: TSC is not invariant)");
+    }
     
 #if ENABLE_PROFILER
+    {
+        f64 overhead_per_hit = g_Profiler.scope_overhead + g_Profiler.parent_overhead;
+        u64 total_overhead = (u64)(overhead_per_hit*(f64)g_Profiler.total_hit_count);
+        fprintf(stdout, "Profiler overhead: %.1f per hit (%.1f in scope, %.1f in parent), estimated total: %llu (%.3f%%)\n", overhead_per_hit, g_Profiler.scope_overhead, g_Profiler.parent_overhead, total_overhead, GetPercentage(total_overhead, total_time));
+    }
+    
     for (u32 i = 0; i < ArrayCount(g_Profiler.anchors); ++i)
     {
         ProfileAnchor *anchor = g_Profiler.anchors + i;
         if (!anchor->label)
             continue;
         
-        fprintf(stdout, "\t%s[%llu]: %llu (%.3f%%)", anchor->label, anchor->hit_count, anchor->elapsed_exclusive, GetPercentage(anchor->elapsed_exclusive, total_time));
+        f64 exclusive_overhead = anchor->hit_count*g_Profiler.scope_overhead + anchor->child_hit_count*g_Profiler.parent_overhead;
+        f64 inclusive_overhead = anchor->hit_count*g_Profiler.scope_overhead + anchor->nested_hit_count*(g_Profiler.scope_overhead + g_Profiler.parent_overhead);
+        u64 elapsed_exclusive = SubtractOverhead(anchor->elapsed_exclusive, exclusive_overhead);
+        u64 elapsed_inclusive = SubtractOverhead(anchor->elapsed_inclusive, inclusive_overhead);
+        
+        fprintf(stdout, "\t%s[%llu]: %llu (%.3f%%)", anchor->label, anchor->hit_count, elapsed_exclusive, GetPercentage(elapsed_exclusive, total_time));
         
         if (anchor->elapsed_exclusive != anchor->elapsed_inclusive)
         {
-            fprintf(stdout, ", w/children: %llu (%.3f%%)", anchor->elapsed_inclusive, GetPercentage(anchor->elapsed_inclusive, total_time));
+            fprintf(stdout, ", w/children: %llu (%.3f%%)", elapsed_inclusive, GetPercentage(elapsed_inclusive, total_time));
         }
         
-        if (anchor->bytes_processed)
+        u64 bytes_processed = GetBytesProcessed(anchor);
+        if (bytes_processed && elapsed_inclusive)
         {
-            f64 megabytes = anchor->bytes_processed/(1024.0*1024.0);
+            f64 megabytes = bytes_processed/(1024.0*1024.0);
             f64 gigabytes = megabytes/1024.0;
-            f64 gigabytes_per_second = cpu_freq*(gigabytes/anchor->elapsed_inclusive);
+            f64 gigabytes_per_second = cpu_freq*(gigabytes/elapsed_inclusive);
             
             fprintf(stdout, " %.3f MB at %.3f GB/s", megabytes, gigabytes_per_second);
+            
+            if (anchor->bytes_written)
+            {
+                fprintf(stdout, " (R: %.3f MB, W: %.3f MB)", anchor->bytes_read/(1024.0*1024.0), anchor->bytes_written/(1024.0*1024.0));
+            }
+        }
+        
+        if (anchor->item_count && elapsed_inclusive)
+        {
+            f64 ns_per_item = (1000000000.0*(f64)elapsed_inclusive/(f64)cpu_freq)/(f64)anchor->item_count;
+            fprintf(stdout, ", %llu items at %.3f ns/item", anchor->item_count, ns_per_item);
+        }
+        fprintf(stdout, "\n");
+        
+#ifdef ENABLE_PROFILER_PERF_COUNTERS
+        PrintAnchorPerfCounters(anchor);
+#endif
+        
+#ifdef ENABLE_PROFILER_HISTOGRAMS
+        PrintAnchorHistogram(anchor, cpu_freq);
+#endif
+        
+#ifdef ENABLE_PROFILER_CPU_TIME
+        PrintAnchorCPUTime(anchor, elapsed_inclusive, cpu_freq);
+#endif
+        
+#ifdef ENABLE_PROFILER_MEMORY
+        PrintAnchorMemory(anchor);
+#endif
+    }
+#elif defined(ENABLE_SAMPLING_PROFILER)
+    u64 sample_count = g_Profiler.sample_count;
+    fprintf(stdout, "Samples: %llu (every %llu us of CPU time)\n", sample_count, (u64)PROFILER_SAMPLE_INTERVAL_US);
+    if (!sample_count)
+        return;
+    
+    for (u32 i = 0; i < ArrayCount(g_Profiler.anchors); ++i)
+    {
+        ProfileSampleAnchor *anchor = g_Profiler.anchors + i;
+        if ((i != 0) && !anchor->label)
+            continue;
+        
+        // NOTE(achal): Each sample is a Bernoulli trial, so the 95% confidence interval of the share is
+        // +-1.96*sqrt(p*(1-p)/n).
+        f64 p = (f64)anchor->samples_exclusive/(f64)sample_count;
+        f64 error = 1.96*sqrt(p*(1.0-p)/(f64)sample_count);
+        
+        fprintf(stdout, "\t%s[%llu]: %.3f%% (+-%.3f%%)", (i == 0) ? "<no anchor>" : anchor->label, anchor->samples_exclusive, p*100.0, error*100.0);
+        
+        if (anchor->samples_inclusive != anchor->samples_exclusive)
+        {
+            fprintf(stdout, ", w/children: %.3f%%", GetPercentage(anchor->samples_inclusive, sample_count));
         }
         fprintf(stdout, "\n");
     }
@@ -0,0 +1,407 @@
+#include "porfavor_types.h"
+#include "platform_metrics.h"
+
+#ifndef __linux__
+#error page_residency needs /proc/self/pagemap and mincore, which are Linux only
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+NOTE(achal):
+The OS-reported page fault count does not tell you how many pages a fault actually brought in.
+The kernel maps more than one page per fault whenever it can: fault-around maps up to
+fault_around_bytes (64K by default) of neighbouring, already-cached pages of a file mapping, and a
+THP-eligible anonymous region gets a whole 2MB page on the first touch.
+
+This tool touches a region one page at a time, in a given order, and after every touch looks at
+/proc/self/pagemap (is the page mapped in our page tables?) and mincore (is the page resident in
+memory at all?) to find out which pages that single touch made available, and in what groups.
+One CSV row per touch goes to stdout, a summary to stderr.
+*/
+
+enum TouchPattern
+{
+    TouchPattern_Forward = 0,
+    TouchPattern_Backward,
+    TouchPattern_Strided,
+    TouchPattern_Random,
+    TouchPattern_Count
+};
+
+static char const *g_TouchPatternNames[TouchPattern_Count] = { "forward", "backward", "strided", "random" };
+
+enum HugePageMode
+{
+    HugePageMode_Default = 0,
+    HugePageMode_Always, // MADV_HUGEPAGE
+    HugePageMode_Never,  // MADV_NOHUGEPAGE
+};
+
+struct AnalyzerParams
+{
+    u64 page_count;
+    TouchPattern pattern;
+    u64 stride;
+    u64 seed;
+    HugePageMode huge_page_mode;
+    char const *file_path;
+};
+
+// NOTE(achal): Bits of a /proc/self/pagemap entry, see Documentation/admin-guide/mm/pagemap.rst.
+#define PAGEMAP_PRESENT (1ull << 63)
+#define PAGEMAP_SWAPPED (1ull << 62)
+#define PAGEMAP_PFN_MASK ((1ull << 55) - 1)
+
+static u64 XorShift64(u64 *state)
+{
+    u64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void BuildTouchOrder(AnalyzerParams *params, u64 *order)
+{
+    u64 page_count = params->page_count;
+    switch (params->pattern)
+    {
+        case TouchPattern_Forward:
+        {
+            for (u64 i = 0; i < page_count; ++i)
+                order[i] = i;
+        } break;
+        
+        case TouchPattern_Backward:
+        {
+            for (u64 i = 0; i < page_count; ++i)
+                order[i] = page_count-1-i;
+        } break;
+        
+        case TouchPattern_Strided:
+        {
+            // NOTE(achal): Every stride-th page, then the same again shifted by one page, and so on
+            // until all pages are covered.
+            u64 idx = 0;
+            for (u64 offset = 0; offset < params->stride; ++offset)
+            {
+                for (u64 page = offset; page < page_count; page += params->stride)
+                    order[idx++] = page;
+            }
+            assert(idx == page_count);
+        } break;
+        
+        case TouchPattern_Random:
+        {
+            for (u64 i = 0; i < page_count; ++i)
+                order[i] = i;
+            
+            u64 state = params->seed ? params->seed : 0x9E3779B97F4A7C15ull;
+            for (u64 i = page_count-1; i > 0; --i)
+            {
+                u64 j = XorShift64(&state) % (i+1);
+                u64 temp = order[i];
+                order[i] = order[j];
+                order[j] = temp;
+            }
+        } break;
+        
+        default: assert(0);
+    }
+}
+
+static b32 ReadPagemap(int pagemap_fd, u8 *base, u64 page_size, u64 page_count, u64 *entries)
+{
+    u64 first_entry = (u64)base/page_size;
+    u64 bytes_to_read = page_count*sizeof(u64);
+    
+    ssize_t bytes_read = pread(pagemap_fd, entries, bytes_to_read, first_entry*sizeof(u64));
+    b32 result = (bytes_read == (ssize_t)bytes_to_read);
+    return result;
+}
+
+static b32 ParseArgs(int argc, char **argv, AnalyzerParams *params)
+{
+    params->page_count = 4096;
+    params->pattern = TouchPattern_Forward;
+    params->stride = 16;
+    params->seed = 1;
+    params->huge_page_mode = HugePageMode_Default;
+    params->file_path = 0;
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        char *arg = argv[i];
+        char *value = (i+1 < argc) ? argv[i+1] : 0;
+        
+        if (strcmp(arg, "--pages") == 0 && value)
+        {
+            params->page_count = strtoull(value, 0, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--pattern") == 0 && value)
+        {
+            u32 pattern = 0;
+            for (; pattern < TouchPattern_Count; ++pattern)
+            {
+                if (strcmp(value, g_TouchPatternNames[pattern]) == 0)
+                    break;
+            }
+            
+            if (pattern == TouchPattern_Count)
+            {
+                fprintf(stderr, "ERROR: Unknown pattern: %s\n", value);
+                return 0;
+            }
+            
+            params->pattern = (TouchPattern)pattern;
+            ++i;
+        }
+        else if (strcmp(arg, "--stride") == 0 && value)
+        {
+            params->stride = strtoull(value, 0, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--seed") == 0 && value)
+        {
+            params->seed = strtoull(value, 0, 10);
+            ++i;
+        }
+        else if (strcmp(arg, "--thp") == 0 && value)
+        {
+            if (strcmp(value, "always") == 0)
+                params->huge_page_mode = HugePageMode_Always;
+            else if (strcmp(value, "never") == 0)
+                params->huge_page_mode = HugePageMode_Never;
+            else if (strcmp(value, "default") == 0)
+                params->huge_page_mode = HugePageMode_Default;
+            else
+            {
+                fprintf(stderr, "ERROR: Unknown THP mode: %s\n", value);
+                return 0;
+            }
+            ++i;
+        }
+        else if (strcmp(arg, "--file") == 0 && value)
+        {
+            params->file_path = value;
+            ++i;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    
+    if (!params->page_count || !params->stride)
+        return 0;
+    
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    AnalyzerParams params;
+    if (!ParseArgs(argc, argv, &params))
+    {
+        fprintf(stderr, "Usage: page_residency [--pages N] [--pattern forward|backward|strided|random] [--stride N] [--seed N] [--thp default|always|never] [--file path]\n");
+        fprintf(stderr, "\tWithout --file an anonymous region is written to, with --file the file is mapped privately and read.\n");
+        return -1;
+    }
+    
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 huge_page_size = 2ull*1024*1024;
+    
+    int file_fd = -1;
+    if (params.file_path)
+    {
+        file_fd = open(params.file_path, O_RDONLY);
+        if (file_fd == -1)
+        {
+            fprintf(stderr, "ERROR: Failed to open file %s\n", params.file_path);
+            return -1;
+        }
+        
+        u64 file_page_count = (GetFileSize(params.file_path) + page_size - 1)/page_size;
+        if (params.page_count > file_page_count)
+            params.page_count = file_page_count;
+    }
+    
+    u64 total_size = params.page_count*page_size;
+    
+    // NOTE(achal): Anonymous regions are placed on a 2MB boundary so that THP can back them at all.
+    u8 *base = 0;
+    u8 *mapping = 0;
+    u64 mapping_size = 0;
+    if (file_fd != -1)
+    {
+        mapping_size = total_size;
+        mapping = (u8 *)mmap(0, mapping_size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+        base = mapping;
+    }
+    else
+    {
+        mapping_size = total_size + huge_page_size;
+        mapping = (u8 *)mmap(0, mapping_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        base = (u8 *)(((u64)mapping + huge_page_size - 1) & ~(huge_page_size - 1));
+    }
+    
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR: Failed to map %llu bytes\n", mapping_size);
+        return -1;
+    }
+    
+    if (params.huge_page_mode == HugePageMode_Always)
+        madvise(base, total_size, MADV_HUGEPAGE);
+    else if (params.huge_page_mode == HugePageMode_Never)
+        madvise(base, total_size, MADV_NOHUGEPAGE);
+    
+    int pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if (pagemap_fd == -1)
+    {
+        fprintf(stderr, "ERROR: Failed to open /proc/self/pagemap\n");
+        return -1;
+    }
+    
+    u64 *order = (u64 *)malloc(params.page_count*sizeof(u64));
+    u64 *pagemap = (u64 *)malloc(params.page_count*sizeof(u64));
+    u8 *was_mapped = (u8 *)calloc(params.page_count, 1);
+    u8 *was_resident = (u8 *)calloc(params.page_count, 1);
+    u8 *residency = (u8 *)malloc(params.page_count);
+    assert(order && pagemap && was_mapped && was_resident && residency);
+    
+    BuildTouchOrder(&params, order);
+    
+    // NOTE(achal): Pages of a file may already be in the page cache before we touch anything.
+    mincore(base, total_size, residency);
+    for (u64 i = 0; i < params.page_count; ++i)
+        was_resident[i] = residency[i] & 1;
+    
+    printf("Touch Index, Page Index, Minor Faults, Major Faults, New Mapped, New Mapped Groups, Group Begin, Group End, Huge, New Resident, Total Mapped, Total Resident\n");
+    
+    u64 total_mapped = 0;
+    u64 total_resident = 0;
+    u64 total_minor_faults = 0;
+    u64 total_major_faults = 0;
+    u64 huge_group_count = 0;
+    b32 has_pfns = 0;
+    
+    for (u64 i = 0; i < params.page_count; ++i)
+        total_resident += was_resident[i];
+    
+    volatile u8 sink = 0;
+    for (u64 touch_idx = 0; touch_idx < params.page_count; ++touch_idx)
+    {
+        u64 page_idx = order[touch_idx];
+        u8 *page = base + page_idx*page_size;
+        
+        u64 minor_begin, major_begin;
+        ReadOSPageFaultCounts(&minor_begin, &major_begin);
+        
+        if (file_fd != -1)
+            sink += *(volatile u8 *)page;
+        else
+            *(volatile u8 *)page = (u8)touch_idx;
+        
+        u64 minor_end, major_end;
+        ReadOSPageFaultCounts(&minor_end, &major_end);
+        
+        u64 minor_faults = minor_end - minor_begin;
+        u64 major_faults = major_end - major_begin;
+        total_minor_faults += minor_faults;
+        total_major_faults += major_faults;
+        
+        b32 retval = ReadPagemap(pagemap_fd, base, page_size, params.page_count, pagemap);
+        assert(retval);
+        mincore(base, total_size, residency);
+        
+        // NOTE(achal): Newly mapped pages, grouped into runs of consecutive pages. The run which contains
+        // the touched page is the one this fault brought in; we report the first run's bounds if the
+        // touched page isn't part of any (i.e. it was already mapped).
+        u64 new_mapped = 0;
+        u64 new_groups = 0;
+        s64 group_begin = -1;
+        s64 group_end = -1;
+        s64 run_begin = -1;
+        u64 new_resident = 0;
+        b32 huge = 0;
+        
+        for (u64 p = 0; p <= params.page_count; ++p)
+        {
+            b32 is_new = 0;
+            if (p < params.page_count)
+            {
+                b32 is_mapped = (pagemap[p] & PAGEMAP_PRESENT) != 0;
+                if (pagemap[p] & PAGEMAP_PFN_MASK)
+                    has_pfns = 1;
+                
+                is_new = is_mapped && !was_mapped[p];
+                was_mapped[p] = (u8)is_mapped;
+                
+                b32 is_resident = (residency[p] & 1);
+                if (is_resident && !was_resident[p])
+                    ++new_resident;
+                was_resident[p] = (u8)is_resident;
+            }
+            
+            if (is_new)
+            {
+                ++new_mapped;
+                if (run_begin == -1)
+                    run_begin = (s64)p;
+            }
+            else if (run_begin != -1)
+            {
+                ++new_groups;
+                s64 run_end = (s64)p - 1;
+                
+                b32 contains_touched = (run_begin <= (s64)page_idx) && ((s64)page_idx <= run_end);
+                if (contains_touched || (group_begin == -1))
+                {
+                    group_begin = run_begin;
+                    group_end = run_end;
+                }
+                
+                // NOTE(achal): A whole 2MB-aligned block showing up at once is what a THP fault looks like.
+                u64 pages_per_huge_page = huge_page_size/page_size;
+                u64 run_length = (u64)(run_end - run_begin + 1);
+                u8 *run_address = base + (u64)run_begin*page_size;
+                if ((run_length >= pages_per_huge_page) && (((u64)run_address & (huge_page_size - 1)) == 0))
+                {
+                    huge = 1;
+                    huge_group_count += run_length/pages_per_huge_page;
+                }
+                
+                run_begin = -1;
+            }
+        }
+        
+        total_mapped += new_mapped;
+        total_resident += new_resident;
+        
+        printf("%llu, %llu, %llu, %llu, %llu, %llu, %lld, %lld, %d, %llu, %llu, %llu\n", touch_idx, page_idx, minor_faults, major_faults, new_mapped, new_groups, group_begin, group_end, huge, new_resident, total_mapped, total_resident);
+    }
+    
+    fprintf(stderr, "Pattern: %s, Pages: %llu (%llu KB), Backing: %s\n", g_TouchPatternNames[params.pattern], params.page_count, total_size/1024, params.file_path ? params.file_path : "anonymous");
+    fprintf(stderr, "Touches: %llu, Reported faults: %llu minor, %llu major\n", params.page_count, total_minor_faults, total_major_faults);
+    u64 total_faults = total_minor_faults + total_major_faults;
+    f64 pages_per_fault = total_faults ? (f64)total_mapped/(f64)total_faults : 0.0;
+    fprintf(stderr, "Pages mapped: %llu (%.3f per fault), 2MB groups: %llu\n", total_mapped, pages_per_fault, huge_group_count);
+    if (!has_pfns)
+        fprintf(stderr, "NOTE: Page frame numbers are hidden without CAP_SYS_ADMIN, THP groups are inferred from alignment\n");
+    
+    munmap(mapping, mapping_size);
+    if (file_fd != -1)
+        close(file_fd);
+    close(pagemap_fd);
+    
+    return 0;
+}
@@ -0,0 +1,277 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "porfavor_types.h"
+
+#include <assert.h>
+#include <string.h>
+
+// NOTE(achal): Hardware performance counters for the calling thread. On Linux these are opened as a
+// single perf_event group (so that all of them are scheduled on the PMU together) and read with
+// `rdpmc` from user space whenever the kernel lets us, which avoids a syscall per read. Everywhere
+// else this compiles down to stubs that report nothing.
+
+enum PerfCounter
+{
+    PerfCounter_Cycles = 0,
+    PerfCounter_Instructions,
+    PerfCounter_L1DMisses,
+    PerfCounter_LLCMisses,
+    PerfCounter_BranchMisses,
+    PerfCounter_DTLBMisses,
+    PerfCounter_Count
+};
+
+static char const *g_PerfCounterNames[PerfCounter_Count] =
+{
+    "Cycles",
+    "Instructions",
+    "L1D Misses",
+    "LLC Misses",
+    "Branch Misses",
+    "dTLB Misses",
+};
+
+struct PerfCounterValues
+{
+    u64 values[PerfCounter_Count];
+    
+    // NOTE(achal): Which way they were read, see ReadPerfCounters.
+    b32 is_from_rdpmc;
+};
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+struct PerfCounterGroup
+{
+    b32 initialized;
+    b32 use_rdpmc;
+    int leader_fd;
+    int fds[PerfCounter_Count];
+    perf_event_mmap_page *mmap_pages[PerfCounter_Count];
+    
+    // NOTE(achal): The counters which were opened, kept past ShutdownPerfCounters for printing.
+    u32 available_mask;
+};
+static PerfCounterGroup g_PerfCounters = { 0, 0, -1, {-1, -1, -1, -1, -1, -1}, {}, 0 };
+
+static void FillPerfEventAttr(perf_event_attr *attr, u32 counter, b32 exclude_kernel)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->exclude_kernel = exclude_kernel;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_GROUP;
+    
+    switch (counter)
+    {
+        case PerfCounter_Cycles:       { attr->type = PERF_TYPE_HARDWARE; attr->config = PERF_COUNT_HW_CPU_CYCLES; } break;
+        case PerfCounter_Instructions: { attr->type = PERF_TYPE_HARDWARE; attr->config = PERF_COUNT_HW_INSTRUCTIONS; } break;
+        case PerfCounter_LLCMisses:    { attr->type = PERF_TYPE_HARDWARE; attr->config = PERF_COUNT_HW_CACHE_MISSES; } break;
+        case PerfCounter_BranchMisses: { attr->type = PERF_TYPE_HARDWARE; attr->config = PERF_COUNT_HW_BRANCH_MISSES; } break;
+        case PerfCounter_L1DMisses:
+        {
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        } break;
+        
+        case PerfCounter_DTLBMisses:
+        {
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        } break;
+        
+        default: assert(0);
+    }
+}
+
+static int OpenPerfEvent(perf_event_attr *attr, int group_fd)
+{
+    // NOTE(achal): This thread, any CPU.
+    int fd = (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+    return fd;
+}
+
+// NOTE(achal): Returns false if not even the cycle counter could be opened (no PMU, e.g. in some VMs,
+// or perf_event_paranoid too strict). Counters which the CPU does not support are left out of the
+// group and always read as zero.
+static b32 InitializePerfCounters()
+{
+    if (g_PerfCounters.initialized)
+        return (g_PerfCounters.leader_fd != -1);
+    
+    g_PerfCounters.initialized = 1;
+    g_PerfCounters.leader_fd = -1;
+    for (u32 i = 0; i < PerfCounter_Count; ++i)
+        g_PerfCounters.fds[i] = -1;
+    
+    // NOTE(achal): Try to count kernel-side work (page faults, syscalls) as well, and fall back to
+    // user-only counting if perf_event_paranoid does not allow it.
+    b32 exclude_kernel = 0;
+    for (u32 i = 0; i < PerfCounter_Count; ++i)
+    {
+        perf_event_attr attr;
+        FillPerfEventAttr(&attr, i, exclude_kernel);
+        if (g_PerfCounters.leader_fd == -1)
+            attr.disabled = 1;
+        
+        int fd = OpenPerfEvent(&attr, g_PerfCounters.leader_fd);
+        if ((fd == -1) && (i == 0) && !exclude_kernel)
+        {
+            exclude_kernel = 1;
+            FillPerfEventAttr(&attr, i, exclude_kernel);
+            attr.disabled = 1;
+            fd = OpenPerfEvent(&attr, -1);
+        }
+        
+        if (fd == -1)
+        {
+            if (i == 0)
+                return 0;
+            continue;
+        }
+        
+        if (g_PerfCounters.leader_fd == -1)
+            g_PerfCounters.leader_fd = fd;
+        g_PerfCounters.fds[i] = fd;
+        g_PerfCounters.available_mask |= (1u << i);
+    }
+    
+    g_PerfCounters.use_rdpmc = 1;
+    for (u32 i = 0; i < PerfCounter_Count; ++i)
+    {
+        if (g_PerfCounters.fds[i] == -1)
+            continue;
+        
+        void *page = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, g_PerfCounters.fds[i], 0);
+        if (page == MAP_FAILED)
+        {
+            g_PerfCounters.use_rdpmc = 0;
+            continue;
+        }
+        
+        g_PerfCounters.mmap_pages[i] = (perf_event_mmap_page *)page;
+        if (!g_PerfCounters.mmap_pages[i]->cap_user_rdpmc)
+            g_PerfCounters.use_rdpmc = 0;
+    }
+    
+    ioctl(g_PerfCounters.leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g_PerfCounters.leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    
+    return 1;
+}
+
+// NOTE(achal): Reads return zeros from here on, IsPerfCounterAvailable still says what was counted.
+static void ShutdownPerfCounters()
+{
+    for (u32 i = 0; i < PerfCounter_Count; ++i)
+    {
+        if (g_PerfCounters.mmap_pages[i])
+            munmap(g_PerfCounters.mmap_pages[i], sysconf(_SC_PAGESIZE));
+        g_PerfCounters.mmap_pages[i] = 0;
+        
+        if (g_PerfCounters.fds[i] != -1)
+            close(g_PerfCounters.fds[i]);
+        g_PerfCounters.fds[i] = -1;
+    }
+    
+    g_PerfCounters.leader_fd = -1;
+    g_PerfCounters.use_rdpmc = 0;
+}
+
+// NOTE(achal): The self-monitoring protocol from linux/perf_event.h. Returns false if the counter
+// is not currently on the PMU (index == 0), in which case the caller has to take the syscall path.
+// The raw counter is pmc_width bits wide and has to be sign extended (an arithmetic shift) before it's
+// added to offset, which the kernel keeps biased by whatever the hardware counter started at.
+static inline b32 ReadPerfCounterRDPMC(perf_event_mmap_page *page, u64 *value)
+{
+    u32 seq;
+    u64 count;
+    do
+    {
+        seq = page->lock;
+        __asm__ __volatile__("" ::: "memory");
+        
+        u32 index = page->index;
+        if (!index)
+            return 0;
+        
+        count = page->offset;
+        
+        u32 width = page->pmc_width;
+        s64 pmc = (s64)__rdpmc(index-1);
+        pmc = (s64)((u64)pmc << (64-width));
+        pmc >>= (64-width);
+        count += (u64)pmc;
+        
+        __asm__ __volatile__("" ::: "memory");
+    } while (page->lock != seq);
+    
+    *value = count;
+    return 1;
+}
+
+// NOTE(achal): With rdpmc when every counter is on the PMU and allow_rdpmc is set, with a read() of the
+// group otherwise. The end of a measured scope passes the begin's is_from_rdpmc as allow_rdpmc so that a
+// scope that began with read() ends with it too. One that began with rdpmc falls back to read() only if
+// the group got descheduled in the meantime, the two give the same counts (see ReadPerfCounterRDPMC).
+static inline void ReadPerfCounters(PerfCounterValues *result, b32 allow_rdpmc)
+{
+    memset(result, 0, sizeof(*result));
+    if (g_PerfCounters.leader_fd == -1)
+        return;
+    
+    if (g_PerfCounters.use_rdpmc && allow_rdpmc)
+    {
+        b32 all_read = 1;
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+        {
+            if (g_PerfCounters.mmap_pages[i] && !ReadPerfCounterRDPMC(g_PerfCounters.mmap_pages[i], result->values+i))
+            {
+                all_read = 0;
+                break;
+            }
+        }
+        
+        if (all_read)
+        {
+            result->is_from_rdpmc = 1;
+            return;
+        }
+        
+        memset(result, 0, sizeof(*result));
+    }
+    
+    // NOTE(achal): PERF_FORMAT_GROUP layout: { nr, values[nr] } in the order the events were added to the group.
+    u64 buffer[1+PerfCounter_Count] = {};
+    ssize_t bytes_read = read(g_PerfCounters.leader_fd, buffer, sizeof(buffer));
+    if (bytes_read <= 0)
+        return;
+    
+    u32 value_idx = 0;
+    for (u32 i = 0; (i < PerfCounter_Count) && (value_idx < buffer[0]); ++i)
+    {
+        if (g_PerfCounters.fds[i] != -1)
+            result->values[i] = buffer[1 + value_idx++];
+    }
+}
+
+static inline b32 IsPerfCounterAvailable(u32 counter)
+{
+    b32 result = ((g_PerfCounters.available_mask >> counter) & 1);
+    return result;
+}
+#else
+static inline b32 InitializePerfCounters() { return 0; }
+static inline void ShutdownPerfCounters() {}
+static inline void ReadPerfCounters(PerfCounterValues *result, b32 allow_rdpmc) { memset(result, 0, sizeof(*result)); }
+static inline b32 IsPerfCounterAvailable(u32 counter) { return 0; }
+#endif
+
+#endif // PERF_COUNTERS_H
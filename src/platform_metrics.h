@@ -2,33 +2,22 @@
 #define PLATFORM_METRICS_H
 
 #include "porfavor_types.h"
+#include "platform_timer.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #if defined(_WIN32) || defined( _WIN64)
+#ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
+#endif
 #include <windows.h>
 #include <psapi.h>
-
-static inline u64 GetOSTimerFrequency()
-{
-    LARGE_INTEGER large_int;
-    BOOL retval = QueryPerformanceFrequency(&large_int);
-    assert(retval != 0);
-    u64 result = large_int.QuadPart;
-    return result;
-}
-
-static inline u64 ReadOSTimer()
-{
-    LARGE_INTEGER large_int;
-    BOOL retval = QueryPerformanceCounter(&large_int);
-    assert(retval != 0);
-    u64 result = large_int.QuadPart;
-    return result;
-}
+#include <io.h>
+#include <stdio.h>
 
 struct Win32_PlatformMetrics
 {
@@ -36,13 +25,13 @@ struct Win32_PlatformMetrics
 };
 static Win32_PlatformMetrics g_PlatformMetrics;
 
-inline static void Win32_InitializePlatformMetrics()
+inline static void InitializePlatformMetrics()
 {
     g_PlatformMetrics.process_handle = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, GetCurrentProcessId());
     assert(g_PlatformMetrics.process_handle);
 }
 
-inline static void Win32_ShutdownPlatformMetrics()
+inline static void ShutdownPlatformMetrics()
 {
     assert(g_PlatformMetrics.process_handle);
     CloseHandle(g_PlatformMetrics.process_handle);
@@ -58,46 +47,323 @@ inline static u64 ReadOSPageFaultCount()
     u64 result = memory_counters.PageFaultCount;
     return result;
 }
-#else
-#error Unsupported Platform!
-#endif
 
-#ifdef _MSC_VER
-#include <intrin.h>
-inline static u64 ReadCPUTimer()
+// NOTE(achal): See ReadOSThreadPageFaultCounts, Windows can't split them.
+inline static void ReadOSPageFaultCounts(u64 *minor, u64 *major)
 {
-    return __rdtsc();
+    *minor = ReadOSPageFaultCount();
+    *major = 0;
+}
+
+// NOTE(achal): In nanoseconds.
+inline static u64 ReadOSThreadCPUTime()
+{
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    BOOL retval = GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time);
+    assert(retval != 0);
+    
+    u64 kernel = ((u64)kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime;
+    u64 user = ((u64)user_time.dwHighDateTime << 32) | user_time.dwLowDateTime;
+    
+    u64 result = (kernel + user)*100;
+    return result;
+}
+
+// NOTE(achal): Windows does not report context switches per thread without ETW, so these stay zero.
+inline static void ReadOSThreadContextSwitchCounts(u64 *voluntary, u64 *involuntary)
+{
+    *voluntary = 0;
+    *involuntary = 0;
+}
+
+// NOTE(achal): Windows only has a process-wide count and cannot tell soft faults from hard ones, so
+// everything is reported as minor.
+inline static void ReadOSThreadPageFaultCounts(u64 *minor, u64 *major)
+{
+    PROCESS_MEMORY_COUNTERS memory_counters = {};
+    memory_counters.cb = sizeof(memory_counters);
+    BOOL retval = GetProcessMemoryInfo(GetCurrentProcess(), &memory_counters, sizeof(memory_counters));
+    assert(retval != 0);
+    
+    *minor = memory_counters.PageFaultCount;
+    *major = 0;
+}
+
+// NOTE(achal): In bytes.
+inline static u64 ReadOSResidentSetSize()
+{
+    PROCESS_MEMORY_COUNTERS memory_counters = {};
+    memory_counters.cb = sizeof(memory_counters);
+    BOOL retval = GetProcessMemoryInfo(GetCurrentProcess(), &memory_counters, sizeof(memory_counters));
+    assert(retval != 0);
+    
+    u64 result = memory_counters.WorkingSetSize;
+    return result;
+}
+
+inline static u64 GetOSPageSize()
+{
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwPageSize;
+}
+
+inline static u32 GetOSLogicalProcessorCount()
+{
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwNumberOfProcessors;
+}
+
+inline static b32 IsStdoutInteractive()
+{
+    b32 result = _isatty(_fileno(stdout)) != 0;
+    return result;
+}
+
+inline static u32 GetOSCurrentCPU()
+{
+    return GetCurrentProcessorNumber();
 }
-#else
-#error Unsupported Compiler!
-#endif
 
-static u64 EstimateCPUTimerFrequency(u64 ms_to_wait)
+inline static b32 PinCurrentThreadToCPU(u32 cpu)
 {
-    u64 os_timer_freq = GetOSTimerFrequency();
-    u64 os_wait_time = (os_timer_freq*ms_to_wait)/1000;
+    if (cpu >= 8*sizeof(DWORD_PTR))
+        return 0;
     
-    u64 os_timer_elapsed = 0;
-    u64 os_timer_begin = ReadOSTimer();
+    b32 result = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+    return result;
+}
+
+inline static b32 RaiseCurrentThreadPriority()
+{
+    SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+    b32 result = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST) != 0;
+    return result;
+}
+
+// NOTE(achal): Windows has power plans instead, which we don't query. Unknown.
+inline static b32 ReadCPUFrequencyGovernor(u32 cpu, char *buffer, u32 buffer_size)
+{
+    return 0;
+}
+
+// NOTE(achal): -1 if unknown, otherwise whether turbo/boost is enabled.
+inline static s32 ReadCPUTurboState()
+{
+    return -1;
+}
+
+// NOTE(achal): In bytes, zero where unknown. sizes[0] is L1d, sizes[1] L2 and sizes[2] L3.
+static void GetOSCacheSizes(u64 *sizes)
+{
+    sizes[0] = sizes[1] = sizes[2] = 0;
     
-    u64 scope_timer_begin = ReadCPUTimer();
-    while (os_timer_elapsed < os_wait_time)
+    DWORD buffer_size = 0;
+    GetLogicalProcessorInformation(0, &buffer_size);
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION *infos = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)malloc(buffer_size);
+    if (infos && GetLogicalProcessorInformation(infos, &buffer_size))
     {
-        u64 os_timer_end = ReadOSTimer();
-        os_timer_elapsed = os_timer_end - os_timer_begin;
+        u32 info_count = buffer_size/sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+        for (u32 i = 0; i < info_count; ++i)
+        {
+            if (infos[i].Relationship != RelationCache)
+                continue;
+            
+            CACHE_DESCRIPTOR *cache = &infos[i].Cache;
+            if ((cache->Level < 1) || (cache->Level > 3) || (cache->Type == CacheInstruction))
+                continue;
+            
+            sizes[cache->Level-1] = cache->Size;
+        }
     }
-    u64 scope_timer_end = ReadCPUTimer();
+    free(infos);
+}
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+inline static void InitializePlatformMetrics() {}
+inline static void ShutdownPlatformMetrics() {}
+
+// NOTE(achal): Unlike Windows, Linux tells minor faults (page was already in memory, or is zero-filled)
+// apart from major ones (had to do I/O).
+inline static void ReadOSPageFaultCounts(u64 *minor, u64 *major)
+{
+    struct rusage usage;
+    int retval = getrusage(RUSAGE_SELF, &usage);
+    assert(retval == 0);
+    
+    *minor = (u64)usage.ru_minflt;
+    *major = (u64)usage.ru_majflt;
+}
+
+inline static u64 ReadOSPageFaultCount()
+{
+    u64 minor, major;
+    ReadOSPageFaultCounts(&minor, &major);
+    
+    u64 result = minor + major;
+    return result;
+}
+
+// NOTE(achal): In nanoseconds.
+inline static u64 ReadOSThreadCPUTime()
+{
+    struct timespec ts;
+    int retval = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    assert(retval == 0);
+    
+    u64 result = (u64)ts.tv_sec*1000000000ull + (u64)ts.tv_nsec;
+    return result;
+}
+
+inline static void ReadOSThreadContextSwitchCounts(u64 *voluntary, u64 *involuntary)
+{
+    struct rusage usage;
+    int retval = getrusage(RUSAGE_THREAD, &usage);
+    assert(retval == 0);
+    
+    *voluntary = (u64)usage.ru_nvcsw;
+    *involuntary = (u64)usage.ru_nivcsw;
+}
+
+inline static void ReadOSThreadPageFaultCounts(u64 *minor, u64 *major)
+{
+    struct rusage usage;
+    int retval = getrusage(RUSAGE_THREAD, &usage);
+    assert(retval == 0);
+    
+    *minor = (u64)usage.ru_minflt;
+    *major = (u64)usage.ru_majflt;
+}
+
+// NOTE(achal): In bytes. The second field of /proc/self/statm is the resident page count. The file
+// is kept open, /proc files can be re-read with pread at offset 0.
+inline static u64 ReadOSResidentSetSize()
+{
+    static int statm_fd = -1;
+    if (statm_fd == -1)
+        statm_fd = open("/proc/self/statm", O_RDONLY);
+    
+    char buffer[128];
+    ssize_t bytes_read = pread(statm_fd, buffer, sizeof(buffer)-1, 0);
+    if (bytes_read <= 0)
+        return 0;
+    buffer[bytes_read] = '\0';
+    
+    unsigned long long total_pages = 0, resident_pages = 0;
+    sscanf(buffer, "%llu %llu", &total_pages, &resident_pages);
+    
+    u64 result = (u64)resident_pages*(u64)sysconf(_SC_PAGESIZE);
+    return result;
+}
+
+inline static u64 GetOSPageSize()
+{
+    return (u64)sysconf(_SC_PAGESIZE);
+}
+
+inline static u32 GetOSLogicalProcessorCount()
+{
+    return (u32)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+inline static b32 IsStdoutInteractive()
+{
+    b32 result = isatty(fileno(stdout)) != 0;
+    return result;
+}
+
+inline static u32 GetOSCurrentCPU()
+{
+    int cpu = sched_getcpu();
+    return (cpu < 0) ? 0 : (u32)cpu;
+}
+
+inline static b32 PinCurrentThreadToCPU(u32 cpu)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    
+    b32 result = sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+    return result;
+}
+
+// NOTE(achal): The highest nice level, for this thread only. Needs CAP_SYS_NICE (or a permissive
+// RLIMIT_NICE). We stay away from SCHED_FIFO, a spinning test at real-time priority can lock up
+// the core it runs on.
+inline static b32 RaiseCurrentThreadPriority()
+{
+    b32 result = setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), -20) == 0;
+    return result;
+}
+
+static b32 ReadSysfsLine(char const *path, char *buffer, u32 buffer_size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    
+    b32 result = fgets(buffer, (int)buffer_size, file) != 0;
+    fclose(file);
+    
+    if (result)
+        buffer[strcspn(buffer, "\n")] = '\0';
+    
+    return result;
+}
+
+inline static b32 ReadCPUFrequencyGovernor(u32 cpu, char *buffer, u32 buffer_size)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_governor", cpu);
+    b32 result = ReadSysfsLine(path, buffer, buffer_size);
+    return result;
+}
+
+// NOTE(achal): -1 if unknown, otherwise whether turbo/boost is enabled. intel_pstate inverts it.
+inline static s32 ReadCPUTurboState()
+{
+    char buffer[16];
+    if (ReadSysfsLine("/sys/devices/system/cpu/intel_pstate/no_turbo", buffer, sizeof(buffer)))
+        return (buffer[0] == '0');
     
-    u64 scope_timer_elapsed = scope_timer_end - scope_timer_begin;
-    u64 scope_timer_freq = (os_timer_freq*scope_timer_elapsed)/os_timer_elapsed;
+    if (ReadSysfsLine("/sys/devices/system/cpu/cpufreq/boost", buffer, sizeof(buffer)))
+        return (buffer[0] == '1');
     
-    return scope_timer_freq;
+    return -1;
+}
+
+// NOTE(achal): In bytes, zero where unknown. sizes[0] is L1d, sizes[1] L2 and sizes[2] L3.
+static void GetOSCacheSizes(u64 *sizes)
+{
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    sizes[0] = (l1 > 0) ? (u64)l1 : 0;
+    sizes[1] = (l2 > 0) ? (u64)l2 : 0;
+    sizes[2] = (l3 > 0) ? (u64)l3 : 0;
 }
+#else
+#error Unsupported Platform!
+#endif
 
 inline static u64 GetFileSize(char const *path)
 {
+#ifdef _WIN32
     struct __stat64 stat;
     int retval = _stat64(path, &stat);
+#else
+    struct stat stat;
+    int retval = ::stat(path, &stat);
+#endif
     assert(retval == 0);
     
     u64 file_size = stat.st_size;
@@ -105,4 +371,53 @@ inline static u64 GetFileSize(char const *path)
     return file_size;
 }
 
+// NOTE(achal): CPUID leaves 80000002H-80000004H, 48 bytes of brand string. buffer must hold 49.
+inline static void ReadCPUBrandString(char *buffer)
+{
+    buffer[0] = '\0';
+    
+    u32 regs[4];
+    ReadCPUID(0x80000000, 0, regs);
+    if (regs[0] < 0x80000004)
+        return;
+    
+    for (u32 i = 0; i < 3; ++i)
+        ReadCPUID(0x80000002 + i, 0, (u32 *)(buffer + 16*i));
+    buffer[48] = '\0';
+    
+    // NOTE(achal): Some vendors pad it with leading spaces.
+    char *begin = buffer;
+    while (*begin == ' ')
+        ++begin;
+    memmove(buffer, begin, strlen(begin)+1);
+}
+
+struct MachineInfo
+{
+    char const *os;
+    char cpu_brand[49];
+    u32 logical_processor_count;
+    u64 page_size;
+    u64 cpu_timer_frequency;
+    char const *cpu_timer_source;
+    b32 is_cpu_timer_invariant;
+};
+
+static MachineInfo GetMachineInfo()
+{
+    MachineInfo result = {};
+#ifdef _WIN32
+    result.os = "windows";
+#else
+    result.os = "linux";
+#endif
+    ReadCPUBrandString(result.cpu_brand);
+    result.logical_processor_count = GetOSLogicalProcessorCount();
+    result.page_size = GetOSPageSize();
+    result.cpu_timer_frequency = GetCPUTimerFrequency();
+    result.cpu_timer_source = g_CPUTimer.source;
+    result.is_cpu_timer_invariant = g_CPUTimer.is_invariant;
+    return result;
+}
+
 #endif // PLATFORM_METRICS_H
@@ -0,0 +1,113 @@
+#ifndef PLATFORM_THREADS_H
+#define PLATFORM_THREADS_H
+
+#include "porfavor_types.h"
+
+#include <assert.h>
+
+// NOTE(achal): Just enough threading for the repetition tester: start/join a thread and a few x64
+// atomics to build spin barriers out of. Thread procs are declared with OS_THREAD_PROC(name) and get
+// their argument in `param`.
+
+#if defined(_WIN32) || defined( _WIN64)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <intrin.h>
+
+#define OS_THREAD_PROC(name) DWORD WINAPI name(void *param)
+typedef HANDLE OSThread;
+
+inline static OSThread CreateOSThread(LPTHREAD_START_ROUTINE proc, void *param)
+{
+    OSThread result = CreateThread(0, 0, proc, param, 0, 0);
+    return result;
+}
+
+inline static void JoinOSThread(OSThread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+inline static void YieldOSThread()
+{
+    SwitchToThread();
+}
+
+// NOTE(achal): x64 loads and stores are already acquire/release, we only have to keep the compiler
+// from moving things across them.
+inline static u32 AtomicLoadU32(u32 volatile *value)
+{
+    u32 result = *value;
+    _ReadWriteBarrier();
+    return result;
+}
+
+inline static void AtomicStoreU32(u32 volatile *value, u32 new_value)
+{
+    _ReadWriteBarrier();
+    *value = new_value;
+}
+
+inline static u32 AtomicIncrementU32(u32 volatile *value)
+{
+    u32 result = (u32)InterlockedIncrement((LONG volatile *)value);
+    return result;
+}
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+#define OS_THREAD_PROC(name) void *name(void *param)
+typedef pthread_t OSThread;
+
+inline static OSThread CreateOSThread(void *(*proc)(void *), void *param)
+{
+    OSThread result = {};
+    int retval = pthread_create(&result, 0, proc, param);
+    assert(retval == 0);
+    return result;
+}
+
+inline static void JoinOSThread(OSThread thread)
+{
+    pthread_join(thread, 0);
+}
+
+inline static void YieldOSThread()
+{
+    sched_yield();
+}
+
+inline static u32 AtomicLoadU32(u32 volatile *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+inline static void AtomicStoreU32(u32 volatile *value, u32 new_value)
+{
+    __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+inline static u32 AtomicIncrementU32(u32 volatile *value)
+{
+    return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+#else
+#error Unsupported Platform!
+#endif
+
+// NOTE(achal): For spin loops. Spins politely for a while and then starts giving the core away, so that
+// waiting on a thread which shares our core (more threads than cores) doesn't take a whole time slice.
+inline static void SpinWait(u32 *spin_count)
+{
+    if (++(*spin_count) < 4096)
+        _mm_pause();
+    else
+        YieldOSThread();
+}
+
+#endif // PLATFORM_THREADS_H
@@ -0,0 +1,281 @@
+#ifndef PLATFORM_TIMER_H
+#define PLATFORM_TIMER_H
+
+#include "porfavor_types.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#if defined(_WIN32) || defined( _WIN64)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+static inline u64 GetOSTimerFrequency()
+{
+    LARGE_INTEGER large_int;
+    BOOL retval = QueryPerformanceFrequency(&large_int);
+    assert(retval != 0);
+    u64 result = large_int.QuadPart;
+    return result;
+}
+
+static inline u64 ReadOSTimer()
+{
+    LARGE_INTEGER large_int;
+    BOOL retval = QueryPerformanceCounter(&large_int);
+    assert(retval != 0);
+    u64 result = large_int.QuadPart;
+    return result;
+}
+#elif defined(__linux__)
+#include <time.h>
+
+static inline u64 GetOSTimerFrequency()
+{
+    return 1000000000ull;
+}
+
+// NOTE(achal): CLOCK_MONOTONIC_RAW is not slewed by NTP, so that it ticks at the same rate as the
+// (invariant) TSC which we calibrate against it.
+static inline u64 ReadOSTimer()
+{
+    struct timespec ts;
+    int retval = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    assert(retval == 0);
+    u64 result = (u64)ts.tv_sec*GetOSTimerFrequency() + (u64)ts.tv_nsec;
+    return result;
+}
+#else
+#error Unsupported Platform!
+#endif
+
+// NOTE(achal): rdtsc isn't ordered with respect to anything, out of order execution can move work from
+// either side of it to the other. For timing short intervals use the Begin/End pair instead. Begin waits
+// for everything before it to finish (lfence) and keeps everything after it from starting until the
+// timestamp is taken (lfence again). End uses rdtscp, which waits for everything before it, and an lfence
+// so that the code following the interval can't start early either. lfence only orders like this on AMD
+// when it's dispatch serializing, which kernels with Spectre mitigations turn on.
+#if defined(_MSC_VER)
+#include <intrin.h>
+inline static u64 ReadCPUTimer()
+{
+    return __rdtsc();
+}
+
+inline static u64 ReadCPUTimerBegin()
+{
+    _mm_lfence();
+    u64 result = __rdtsc();
+    _mm_lfence();
+    return result;
+}
+
+inline static u64 ReadCPUTimerEnd()
+{
+    unsigned int aux;
+    u64 result = __rdtscp(&aux);
+    _mm_lfence();
+    return result;
+}
+
+inline static void ReadCPUID(u32 leaf, u32 subleaf, u32 *regs)
+{
+    __cpuidex((int *)regs, (int)leaf, (int)subleaf);
+}
+#elif defined(__GNUC__) || defined(__clang__)
+#include <x86intrin.h>
+#include <cpuid.h>
+inline static u64 ReadCPUTimer()
+{
+    return __rdtsc();
+}
+
+inline static u64 ReadCPUTimerBegin()
+{
+    _mm_lfence();
+    u64 result = __rdtsc();
+    _mm_lfence();
+    return result;
+}
+
+inline static u64 ReadCPUTimerEnd()
+{
+    unsigned int aux;
+    u64 result = __rdtscp(&aux);
+    _mm_lfence();
+    return result;
+}
+
+inline static void ReadCPUID(u32 leaf, u32 subleaf, u32 *regs)
+{
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+}
+#else
+#error Unsupported Compiler!
+#endif
+
+static u64 EstimateCPUTimerFrequency(u64 ms_to_wait)
+{
+    u64 os_timer_freq = GetOSTimerFrequency();
+    u64 os_wait_time = (os_timer_freq*ms_to_wait)/1000;
+    
+    u64 os_timer_elapsed = 0;
+    u64 os_timer_begin = ReadOSTimer();
+    
+    u64 scope_timer_begin = ReadCPUTimer();
+    while (os_timer_elapsed < os_wait_time)
+    {
+        u64 os_timer_end = ReadOSTimer();
+        os_timer_elapsed = os_timer_end - os_timer_begin;
+    }
+    u64 scope_timer_end = ReadCPUTimer();
+    
+    u64 scope_timer_elapsed = scope_timer_end - scope_timer_begin;
+    u64 scope_timer_freq = (os_timer_freq*scope_timer_elapsed)/os_timer_elapsed;
+    
+    return scope_timer_freq;
+}
+
+// NOTE(achal): CPUID.80000007H:EDX[8]. Without it the TSC rate follows the core clock and no
+// fixed frequency (reported or calibrated) can be trusted for long.
+static b32 IsCPUTimerInvariant()
+{
+    u32 regs[4];
+    ReadCPUID(0x80000000, 0, regs);
+    if (regs[0] < 0x80000007)
+        return 0;
+    
+    ReadCPUID(0x80000007, 0, regs);
+    b32 result = (b32)((regs[3] >> 8) & 1);
+    return result;
+}
+
+static u64 ReadCPUTimerFrequencyFromCPUID(char const **source)
+{
+    u32 regs[4];
+    ReadCPUID(0, 0, regs);
+    u32 max_leaf = regs[0];
+    
+    // NOTE(achal): Leaf 15H: TSC frequency = crystal frequency * EBX/EAX. Some parts leave the crystal
+    // frequency (ECX) zero, in which case it is derived from the base frequency in leaf 16H, as the
+    // SDM suggests.
+    if (max_leaf >= 0x15)
+    {
+        ReadCPUID(0x15, 0, regs);
+        u64 denominator = regs[0];
+        u64 numerator = regs[1];
+        u64 crystal_hz = regs[2];
+        
+        if (denominator && numerator)
+        {
+            if (crystal_hz)
+            {
+                *source = "CPUID.15H";
+                return (crystal_hz*numerator)/denominator;
+            }
+            
+            if (max_leaf >= 0x16)
+            {
+                ReadCPUID(0x16, 0, regs);
+                u64 base_hz = (u64)(regs[0] & 0xFFFF)*1000000ull;
+                if (base_hz)
+                {
+                    *source = "CPUID.15H+16H";
+                    return base_hz;
+                }
+            }
+        }
+    }
+    
+    // NOTE(achal): Hypervisors (KVM, VMware, ...) report the TSC rate they expose in leaf 40000010H, in kHz.
+    ReadCPUID(1, 0, regs);
+    b32 is_hypervisor_present = (b32)((regs[2] >> 31) & 1);
+    if (is_hypervisor_present)
+    {
+        ReadCPUID(0x40000000, 0, regs);
+        if (regs[0] >= 0x40000010)
+        {
+            ReadCPUID(0x40000010, 0, regs);
+            if (regs[0])
+            {
+                *source = "CPUID.40000010H";
+                return (u64)regs[0]*1000ull;
+            }
+        }
+    }
+    
+    // NOTE(achal): Leaf 16H alone only gives the base frequency rounded to MHz, which on the parts that
+    // have it is also the TSC frequency.
+    if (max_leaf >= 0x16)
+    {
+        ReadCPUID(0x16, 0, regs);
+        u64 base_hz = (u64)(regs[0] & 0xFFFF)*1000000ull;
+        if (base_hz)
+        {
+            *source = "CPUID.16H";
+            return base_hz;
+        }
+    }
+    
+    return 0;
+}
+
+static u64 ReadCPUTimerFrequencyFromOS(char const **source)
+{
+    u64 result = 0;
+    
+#ifdef __linux__
+    // NOTE(achal): Not exposed by every kernel, but when it is it's the kernel's own refined calibration.
+    FILE *file = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "rb");
+    if (file)
+    {
+        unsigned long long khz = 0;
+        if (fscanf(file, "%llu", &khz) == 1)
+        {
+            *source = "tsc_freq_khz";
+            result = (u64)khz*1000ull;
+        }
+        fclose(file);
+    }
+#endif
+    
+    return result;
+}
+
+struct CPUTimer
+{
+    u64 frequency;
+    b32 is_invariant;
+    char const *source;
+};
+static CPUTimer g_CPUTimer;
+
+// NOTE(achal): Calibrating against the OS timer is the last resort since it has to busy-wait, and it
+// is only done once per process. A non-invariant TSC always gets calibrated because whatever the
+// CPU reports as its nominal rate has nothing to do with how fast the TSC is ticking right now.
+static u64 GetCPUTimerFrequency()
+{
+    if (!g_CPUTimer.frequency)
+    {
+        g_CPUTimer.is_invariant = IsCPUTimerInvariant();
+        
+        if (g_CPUTimer.is_invariant)
+        {
+            g_CPUTimer.frequency = ReadCPUTimerFrequencyFromOS(&g_CPUTimer.source);
+            if (!g_CPUTimer.frequency)
+                g_CPUTimer.frequency = ReadCPUTimerFrequencyFromCPUID(&g_CPUTimer.source);
+        }
+        
+        if (!g_CPUTimer.frequency)
+        {
+            g_CPUTimer.frequency = EstimateCPUTimerFrequency(20);
+            g_CPUTimer.source = "Calibration";
+        }
+    }
+    
+    return g_CPUTimer.frequency;
+}
+
+#endif // PLATFORM_TIMER_H
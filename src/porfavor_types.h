@@ -5,9 +5,11 @@
 
 typedef uint8_t u8;
 typedef uint32_t u32;
-typedef uint64_t u64;
+// NOTE(achal): Not uint64_t, which is `unsigned long` on LP64 Linux, so that %llu works everywhere.
+typedef unsigned long long u64;
 
 typedef int32_t s32;
+typedef long long s64;
 
 typedef u32 b32;
 
@@ -0,0 +1,306 @@
+#include "rep_tester.h"
+
+#include <math.h>
+
+/*
+NOTE(achal):
+Bandwidth as a function of working set size. Each kernel makes repeated passes over the first `size`
+bytes of one big, pre-touched buffer, for sizes from 4KB up to --size in quarter-octave steps. As the
+working set outgrows a cache level the bandwidth drops to that of the next one, and those drops
+(knees) are located on each kernel's curve and compared against the cache sizes the OS reports.
+
+Output is CSV on stdout, one row per size with the best (min time) GB/s of each kernel, followed by
+the knees. It's a sweep (see RunRepTestSweepPoint), --json and --baseline work per kernel and size.
+*/
+
+struct TestParams
+{
+    u64 pass_count;
+};
+
+// NOTE(achal): Enough passes that even the smallest working sets take long enough per repetition
+// for the timing overhead to vanish.
+#define MIN_BYTES_PER_REPETITION (32ull*1024*1024)
+
+#define MAX_SIZE_COUNT 128
+
+// NOTE(achal): How far (as a factor) a knee may be from a reported cache size to be named after it.
+#define MAX_KNEE_DISTANCE 4.0
+
+// NOTE(achal): Passes after the first touch the same memory, so without the barrier after each one the
+// compiler may merge them (Read) or keep only the last (Write, Copy).
+REP_TEST(Read)
+{
+    u64 *data = (u64 *)buffer->data;
+    u64 count = buffer->size/sizeof(u64);
+    
+    TimeTrackedData time_data = {};
+    
+    u64 sum = 0;
+    BeginTime(&time_data);
+    for (u64 pass = 0; pass < params->pass_count; ++pass)
+    {
+        for (u64 i = 0; i < count; ++i)
+            sum += data[i];
+        ClobberMemory();
+    }
+    DoNotOptimize(&sum);
+    EndTime(&time_data);
+    
+    SetRepTestChecksum(&time_data, sum);
+    time_data.bytes_processed = params->pass_count*count*sizeof(u64);
+    return time_data;
+}
+
+REP_TEST(Write)
+{
+    u64 *data = (u64 *)buffer->data;
+    u64 count = buffer->size/sizeof(u64);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    for (u64 pass = 0; pass < params->pass_count; ++pass)
+    {
+        for (u64 i = 0; i < count; ++i)
+            data[i] = pass + i;
+        ClobberMemory();
+    }
+    EndTime(&time_data);
+    
+    time_data.bytes_processed = params->pass_count*count*sizeof(u64);
+    return time_data;
+}
+
+// NOTE(achal): Copies the first half of the working set onto the second, so that it's the same working
+// set as the other kernels. Counts both the bytes read and the bytes written.
+REP_TEST(Copy)
+{
+    u64 half_size = buffer->size/2;
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    for (u64 pass = 0; pass < params->pass_count; ++pass)
+    {
+        memcpy(buffer->data + half_size, buffer->data, half_size);
+        ClobberMemory();
+    }
+    EndTime(&time_data);
+    
+    time_data.bytes_processed = params->pass_count*2*half_size;
+    return time_data;
+}
+
+// NOTE(achal): A knee is a run of consecutive steps over which the bandwidth keeps falling (by more than
+// 3% a step), and which falls by at least 20% in total. Its position is the last size before the fall,
+// i.e. the largest working set that still fit. Gradual transitions spread over several steps, which
+// is why we look at runs and not at single steps. The curve is first smoothed with a median of three
+// so that a single noisy step neither starts nor ends a run.
+static u32 FindKnees(f64 *gbps, u32 size_count, u32 *knees, u32 max_knee_count)
+{
+    f64 smoothed[MAX_SIZE_COUNT];
+    for (u32 idx = 0; idx < size_count; ++idx)
+    {
+        if ((idx == 0) || (idx+1 == size_count))
+        {
+            smoothed[idx] = gbps[idx];
+            continue;
+        }
+        
+        f64 a = gbps[idx-1], b = gbps[idx], c = gbps[idx+1];
+        f64 lo = (a < b) ? a : b;
+        f64 hi = (a < b) ? b : a;
+        smoothed[idx] = (c < lo) ? lo : ((c > hi) ? hi : c);
+    }
+    
+    u32 knee_count = 0;
+    u32 idx = 0;
+    while ((idx+1 < size_count) && (knee_count < max_knee_count))
+    {
+        if (smoothed[idx+1] < 0.97*smoothed[idx])
+        {
+            u32 begin = idx;
+            while ((idx+1 < size_count) && (smoothed[idx+1] < 0.97*smoothed[idx]))
+                ++idx;
+            
+            if (smoothed[idx] < 0.8*smoothed[begin])
+                knees[knee_count++] = begin;
+        }
+        else
+        {
+            ++idx;
+        }
+    }
+    
+    return knee_count;
+}
+
+static void PrintSize(u64 size)
+{
+    if (size >= 1024ull*1024*1024)
+        printf("%.2f GB", (f64)size/(1024.0*1024.0*1024.0));
+    else if (size >= 1024ull*1024)
+        printf("%.2f MB", (f64)size/(1024.0*1024.0));
+    else
+        printf("%.2f KB", (f64)size/1024.0);
+}
+
+int main(int argc, char **argv)
+{
+    RepTesterConfig config = DefaultRepTesterConfig(0.2, 1ull*1024*1024*1024, 0);
+    if (!ParseRepTestSweepCommandLine(argc, argv, &config))
+        return -1;
+    if (config.list_only)
+        return ListRepTests(&config);
+    
+    // NOTE(achal): Quarter-octave steps, rounded to whole cache lines (pairs of them, for Copy's halves).
+    u64 sizes[MAX_SIZE_COUNT];
+    u32 size_count = 0;
+    for (u32 step = 0; size_count < MAX_SIZE_COUNT; ++step)
+    {
+        u64 size = (u64)(4096.0*pow(2.0, step/4.0)) & ~127ull;
+        if (size > config.size)
+            break;
+        sizes[size_count++] = size;
+    }
+    
+    if (!size_count)
+    {
+        fprintf(stderr, "ERROR: --size has to be at least 4KB\n");
+        return -1;
+    }
+    
+    Buffer reuse_buffer = {};
+    reuse_buffer.size = sizes[size_count-1];
+    reuse_buffer.data = (u8 *)malloc(reuse_buffer.size);
+    if (!reuse_buffer.data)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate %llu bytes\n", reuse_buffer.size);
+        return -1;
+    }
+    memset(reuse_buffer.data, 1, reuse_buffer.size);
+    
+    RepTester rep_tester;
+    if (!BeginRepTestSweep(&rep_tester, &config, &reuse_buffer))
+        return -1;
+    
+    b32 is_enabled[REP_TESTER_MAX_TESTS];
+    for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+        is_enabled[fn_idx] = IsRepTestSelected(&config, g_RepTests + fn_idx);
+    
+    printf("Size");
+    for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+    {
+        if (is_enabled[fn_idx])
+            printf(", %s GB/s", g_RepTests[fn_idx].name);
+    }
+    printf("\n");
+    
+    // NOTE(achal): Too big for the stack.
+    static RepTestStats stats;
+    static f64 gbps[REP_TESTER_MAX_TESTS][MAX_SIZE_COUNT];
+    
+    for (u32 size_idx = 0; size_idx < size_count; ++size_idx)
+    {
+        u64 size = sizes[size_idx];
+        rep_tester.reuse_buffer.size = size;
+        
+        TestParams test_params = {};
+        test_params.pass_count = (size < MIN_BYTES_PER_REPETITION) ? MIN_BYTES_PER_REPETITION/size : 1;
+        
+        char point[32];
+        snprintf(point, sizeof(point), "%llu", size);
+        
+        printf("%s", point);
+        for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+        {
+            if (!is_enabled[fn_idx])
+                continue;
+            
+            RunRepTestSweepPoint(&rep_tester, g_RepTests + fn_idx, &test_params, point, &stats);
+            
+            f64 seconds = (f64)stats.min.time/(f64)rep_tester.cpu_freq;
+            gbps[fn_idx][size_idx] = ((f64)stats.bytes_processed/(1024.0*1024.0*1024.0))/seconds;
+            printf(", %.3f", gbps[fn_idx][size_idx]);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    
+    u64 reported_sizes[3];
+    GetOSCacheSizes(reported_sizes);
+    char const *level_names[] = {"L1", "L2", "L3"};
+    
+    for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+    {
+        if (!is_enabled[fn_idx])
+            continue;
+        
+        u32 knees[3];
+        u32 knee_count = FindKnees(gbps[fn_idx], size_count, knees, ArrayCount(knees));
+        
+        printf("\n%s knees:\n", g_RepTests[fn_idx].name);
+        
+        // NOTE(achal): A kernel which can't go faster than L2 shows no L1 knee at all, so rather than
+        // counting knees each one is named after the reported cache size it lands closest to (on a log
+        // scale). A level names at most one knee, and only one within a factor of MAX_KNEE_DISTANCE of its
+        // size, anything else is printed unnamed. Only when the OS reports no sizes at all are the knees
+        // counted off instead.
+        b32 has_reported_sizes = 0;
+        for (u32 level_idx = 0; level_idx < ArrayCount(level_names); ++level_idx)
+            has_reported_sizes |= (reported_sizes[level_idx] != 0);
+        
+        b32 is_level_claimed[ArrayCount(level_names)] = {};
+        for (u32 knee_idx = 0; knee_idx < knee_count; ++knee_idx)
+        {
+            u32 size_idx = knees[knee_idx];
+            
+            u32 level = ArrayCount(level_names);
+            if (has_reported_sizes)
+            {
+                f64 best_distance = log(MAX_KNEE_DISTANCE);
+                for (u32 level_idx = 0; level_idx < ArrayCount(level_names); ++level_idx)
+                {
+                    if (!reported_sizes[level_idx] || is_level_claimed[level_idx])
+                        continue;
+                    
+                    f64 distance = fabs(log((f64)sizes[size_idx]/(f64)reported_sizes[level_idx]));
+                    if (distance <= best_distance)
+                    {
+                        best_distance = distance;
+                        level = level_idx;
+                    }
+                }
+            }
+            else if (knee_idx < ArrayCount(level_names))
+            {
+                level = knee_idx;
+            }
+            
+            if (level < ArrayCount(level_names))
+            {
+                is_level_claimed[level] = 1;
+                char const *to = (level+1 < ArrayCount(level_names)) ? level_names[level+1] : "DRAM";
+                printf("  %s -> %s at ", level_names[level], to);
+            }
+            else
+            {
+                printf("  unnamed at ");
+            }
+            PrintSize(sizes[size_idx]);
+            printf(" (%.3f GB/s)", gbps[fn_idx][size_idx]);
+            if ((level < ArrayCount(level_names)) && reported_sizes[level])
+            {
+                printf(", reported %s: ", level_names[level]);
+                PrintSize(reported_sizes[level]);
+            }
+            printf("\n");
+        }
+        
+        if (!knee_count)
+            printf("  none found\n");
+    }
+    
+    return EndRepTester(&rep_tester);
+}
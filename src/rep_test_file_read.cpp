@@ -1,6 +1,11 @@
 #include "rep_tester.h"
 
+#ifdef _WIN32
 #include <io.h>
+#elif defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
 #include <fcntl.h>
 
 struct TestParams
@@ -8,7 +13,75 @@ struct TestParams
     char const *path;
 };
 
-static TimeTrackedData freadTest(TestParams *params, Buffer *buffer)
+/*
+NOTE(achal):
+Every repetition after the first reads the file out of the page cache, so on its own a test only ever
+measures warm reads. On Linux each test is therefore registered twice by FILE_READ_TEST: as is, and as
+<name>_cold which evicts the file from the page cache before every repetition (outside the timed
+interval), so that it has to come from the device. The two run back to back and are put side by side at
+the end. read_direct_cold is the cold read which bypasses the page cache altogether.
+
+Windows has no way of evicting a single file, so there the tests are only registered warm.
+*/
+#ifdef __linux__
+#include <unistd.h>
+
+// NOTE(achal): Only drops clean pages which nobody has mapped, which is all of them for our input.
+static void EvictFromPageCache(char const *path)
+{
+    int file = open(path, O_RDONLY);
+    assert(file != -1);
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+}
+
+// NOTE(achal): Fraction of the file's pages which are in the page cache.
+static f64 GetPageCacheResidency(char const *path)
+{
+    int file = open(path, O_RDONLY);
+    if (file == -1)
+        return 0.0;
+    
+    f64 result = 0.0;
+    u64 size = GetFileSize(path);
+    void *data = size ? mmap(0, size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+    if (data != MAP_FAILED)
+    {
+        u64 page_size = GetOSPageSize();
+        u64 page_count = (size + page_size - 1)/page_size;
+        unsigned char *residency = (unsigned char *)malloc(page_count);
+        if (mincore(data, size, residency) == 0)
+        {
+            u64 resident_count = 0;
+            for (u64 page_idx = 0; page_idx < page_count; ++page_idx)
+                resident_count += (residency[page_idx] & 1);
+            result = (f64)resident_count/(f64)page_count;
+        }
+        free(residency);
+        munmap(data, size);
+    }
+    
+    close(file);
+    return result;
+}
+
+#define FILE_READ_TEST(name) \
+static TimeTrackedData FileReadTest_##name(TestParams *params, Buffer *buffer); \
+REP_TEST(name) \
+{ \
+    return FileReadTest_##name(params, buffer); \
+} \
+REP_TEST(name##_cold) \
+{ \
+    EvictFromPageCache(params->path); \
+    return FileReadTest_##name(params, buffer); \
+} \
+static TimeTrackedData FileReadTest_##name(TestParams *params, Buffer *buffer)
+#else
+#define FILE_READ_TEST(name) REP_TEST(name)
+#endif
+
+FILE_READ_TEST(fread)
 {
     FILE *file = fopen(params->path, "rb");
     
@@ -25,10 +98,12 @@ static TimeTrackedData freadTest(TestParams *params, Buffer *buffer)
     
     fclose(file);
     
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
     return time_data;
 }
 
-static TimeTrackedData _readTest(TestParams *params, Buffer *buffer)
+#ifdef _WIN32
+REP_TEST(_read)
 {
     int file = _open(params->path, _O_RDONLY|_O_BINARY);
     
@@ -62,10 +137,11 @@ static TimeTrackedData _readTest(TestParams *params, Buffer *buffer)
     }
     
     _close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
     return time_data;
 }
 
-static TimeTrackedData ReadFileTest(TestParams *params, Buffer *buffer)
+REP_TEST(ReadFile)
 {
     HANDLE file_handle = CreateFileA(params->path, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
     
@@ -102,34 +178,485 @@ static TimeTrackedData ReadFileTest(TestParams *params, Buffer *buffer)
     }
     
     CloseHandle(file_handle);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
     return time_data;
 }
+#elif defined(__linux__)
+// NOTE(achal): The Linux ways of getting a file into memory. The file is opened before and closed after
+// the timed interval, like for the Windows tests, but each test times all of its calls as one interval.
+
+// NOTE(achal): For the tests which read in chunks (or have chunks in flight). read() and friends move at
+// most 0x7FFFF000 bytes per call, so even the single-call variants loop.
+#define READ_CHUNK_SIZE (1024*1024)
+#define MAX_READ_CALL_SIZE 0x7FFFF000ull
+
+// NOTE(achal): O_DIRECT needs the buffer, the file offset and the size aligned to the logical block size of
+// the device, and 4K covers all of them.
+#define DIRECT_IO_ALIGNMENT 4096
+
+static void ReadChunked(int file, u8 *data, u64 size, u64 chunk_size)
+{
+    u64 offset = 0;
+    while (offset < size)
+    {
+        u64 read_size = size - offset;
+        if (read_size > chunk_size)
+            read_size = chunk_size;
+        
+        ssize_t retval = read(file, data + offset, read_size);
+        assert(retval > 0);
+        offset += (u64)retval;
+    }
+}
 
-int main()
+FILE_READ_TEST(read)
 {
-    char const path[] = "data/haversine_input_10000000.json";
+    int file = open(params->path, O_RDONLY);
+    assert(file != -1);
     
-    Buffer reuse_buffer = {};
-    reuse_buffer.size = GetFileSize(path);
-    reuse_buffer.data = (u8 *)malloc(reuse_buffer.size);
+    TimeTrackedData time_data = {};
     
-    RepTester rep_tester = MakeRepTester(10.0, &reuse_buffer);
+    BeginTime(&time_data);
+    ReadChunked(file, buffer->data, buffer->size, MAX_READ_CALL_SIZE);
+    EndTime(&time_data);
+    
+    close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
+    return time_data;
+}
+
+FILE_READ_TEST(read_chunked)
+{
+    int file = open(params->path, O_RDONLY);
+    assert(file != -1);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    ReadChunked(file, buffer->data, buffer->size, READ_CHUNK_SIZE);
+    EndTime(&time_data);
+    
+    close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
+    return time_data;
+}
+
+FILE_READ_TEST(pread)
+{
+    int file = open(params->path, O_RDONLY);
+    assert(file != -1);
+    
+    TimeTrackedData time_data = {};
     
-    TestFunction test_functions[] =
+    BeginTime(&time_data);
+    u64 offset = 0;
+    while (offset < buffer->size)
     {
-        {"fread", freadTest},
-        {"ReadFile", ReadFileTest},
-        {"_read", _readTest},
-    };
+        u64 read_size = buffer->size - offset;
+        if (read_size > MAX_READ_CALL_SIZE)
+            read_size = MAX_READ_CALL_SIZE;
+        
+        ssize_t retval = pread(file, buffer->data + offset, read_size, (off_t)offset);
+        assert(retval > 0);
+        offset += (u64)retval;
+    }
+    EndTime(&time_data);
     
-    TestParams test_params = {};
-    test_params.path = path;
+    close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): Doesn't use the buffer, the mapping is where the file ends up. One read per page makes
+// every page resident and mapped, which is the part that costs; the munmap is timed as well since whoever
+// maps a file also has to tear the mapping down again.
+static TimeTrackedData MapAndTouchFile(char const *path, u64 size, int flags)
+{
+    int file = open(path, O_RDONLY);
+    assert(file != -1);
+    
+    u64 page_size = GetOSPageSize();
+    
+    TimeTrackedData time_data = {};
+    
+    u64 sum = 0;
+    BeginTime(&time_data);
+    u8 *data = (u8 *)mmap(0, size, PROT_READ, MAP_PRIVATE|flags, file, 0);
+    assert(data != MAP_FAILED);
+    for (u64 offset = 0; offset < size; offset += page_size)
+        sum += data[offset];
+    DoNotOptimize(&sum);
+    munmap(data, size);
+    EndTime(&time_data);
+    
+    close(file);
+    SetRepTestChecksum(&time_data, sum);
+    time_data.bytes_processed = size;
+    return time_data;
+}
+
+FILE_READ_TEST(mmap_touch)
+{
+    return MapAndTouchFile(params->path, buffer->size, 0);
+}
+
+FILE_READ_TEST(mmap_populate)
+{
+    return MapAndTouchFile(params->path, buffer->size, MAP_POPULATE);
+}
+
+// NOTE(achal): Aligned blocks go straight into the buffer when it's aligned. Everything else (an unaligned
+// buffer, the partial block at the end) goes through an aligned bounce chunk, as it has to in real code too.
+FILE_READ_TEST(read_direct)
+{
+    int file = open(params->path, O_RDONLY|O_DIRECT);
+    assert(file != -1);
+    
+    u8 *bounce = (u8 *)aligned_alloc(DIRECT_IO_ALIGNMENT, READ_CHUNK_SIZE);
+    assert(bounce);
+    memset(bounce, 0, READ_CHUNK_SIZE);
+    
+    b32 is_buffer_aligned = (((u64)buffer->data % DIRECT_IO_ALIGNMENT) == 0);
     
-    for (u32 fn_idx = 0; fn_idx < ArrayCount(test_functions); ++fn_idx)
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 offset = 0;
+    while (offset < buffer->size)
     {
-        TestFunction *test_function = test_functions + fn_idx;
-        RunTest(&rep_tester, test_function, &test_params);
+        u64 size = buffer->size - offset;
+        if (size > READ_CHUNK_SIZE)
+            size = READ_CHUNK_SIZE;
+        
+        u64 aligned_size = is_buffer_aligned ? (size & ~(u64)(DIRECT_IO_ALIGNMENT-1)) : 0;
+        if (aligned_size)
+        {
+            ssize_t retval = pread(file, buffer->data + offset, aligned_size, (off_t)offset);
+            assert(retval == (ssize_t)aligned_size);
+            size = aligned_size;
+        }
+        else
+        {
+            ssize_t retval = pread(file, bounce, AlignUp(size, DIRECT_IO_ALIGNMENT), (off_t)offset);
+            assert(retval >= (ssize_t)size);
+            memcpy(buffer->data + offset, bounce, size);
+        }
+        
+        offset += size;
     }
+    EndTime(&time_data);
+    
+    free(bounce);
+    close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
+    return time_data;
+}
+
+FILE_READ_TEST(read_readahead)
+{
+    int file = open(params->path, O_RDONLY);
+    assert(file != -1);
     
-    return 0;
-}
\ No newline at end of file
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    posix_fadvise(file, 0, (off_t)buffer->size, POSIX_FADV_SEQUENTIAL);
+    readahead(file, 0, buffer->size);
+    ReadChunked(file, buffer->data, buffer->size, READ_CHUNK_SIZE);
+    EndTime(&time_data);
+    
+    close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): io_uring through the raw syscalls, i.e. without liburing: the submission and completion
+// rings are shared with the kernel through mmap, we fill in submission entries and bump the tail, the
+// kernel fills in completions and bumps theirs.
+struct IOUring
+{
+    int fd;
+    
+    u8 *sq_ring;
+    u64 sq_ring_size;
+    u32 *sq_tail;
+    u32 *sq_mask;
+    u32 *sq_array;
+    io_uring_sqe *sqes;
+    u64 sqes_size;
+    
+    u8 *cq_ring;
+    u64 cq_ring_size;
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 *cq_mask;
+    io_uring_cqe *cqes;
+};
+
+static void DestroyIOUring(IOUring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && (ring->cq_ring != ring->sq_ring))
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd != -1)
+        close(ring->fd);
+    
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// NOTE(achal): Returns false if io_uring is not available (old kernel, or disabled by a sysctl or seccomp).
+static b32 CreateIOUring(IOUring *ring, u32 entry_count)
+{
+    memset(ring, 0, sizeof(*ring));
+    
+    io_uring_params ring_params = {};
+    ring->fd = (int)syscall(__NR_io_uring_setup, entry_count, &ring_params);
+    if (ring->fd == -1)
+        return 0;
+    
+    ring->sq_ring_size = ring_params.sq_off.array + ring_params.sq_entries*sizeof(u32);
+    ring->cq_ring_size = ring_params.cq_off.cqes + ring_params.cq_entries*sizeof(io_uring_cqe);
+    if (ring_params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    
+    void *sq_ring = mmap(0, ring->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        DestroyIOUring(ring);
+        return 0;
+    }
+    ring->sq_ring = (u8 *)sq_ring;
+    
+    if (ring_params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        void *cq_ring = mmap(0, ring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            DestroyIOUring(ring);
+            return 0;
+        }
+        ring->cq_ring = (u8 *)cq_ring;
+    }
+    
+    ring->sqes_size = ring_params.sq_entries*sizeof(io_uring_sqe);
+    void *sqes = mmap(0, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        DestroyIOUring(ring);
+        return 0;
+    }
+    ring->sqes = (io_uring_sqe *)sqes;
+    
+    ring->sq_tail = (u32 *)(ring->sq_ring + ring_params.sq_off.tail);
+    ring->sq_mask = (u32 *)(ring->sq_ring + ring_params.sq_off.ring_mask);
+    ring->sq_array = (u32 *)(ring->sq_ring + ring_params.sq_off.array);
+    ring->cq_head = (u32 *)(ring->cq_ring + ring_params.cq_off.head);
+    ring->cq_tail = (u32 *)(ring->cq_ring + ring_params.cq_off.tail);
+    ring->cq_mask = (u32 *)(ring->cq_ring + ring_params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(ring->cq_ring + ring_params.cq_off.cqes);
+    
+    return 1;
+}
+
+// NOTE(achal): Keeps queue_depth reads of READ_CHUNK_SIZE in flight, each into its place in the buffer.
+// The ring is set up and torn down outside the timed interval, it's a one time cost in a real reader.
+static TimeTrackedData ReadWithIOUring(TestParams *params, Buffer *buffer, u32 queue_depth)
+{
+    int file = open(params->path, O_RDONLY);
+    assert(file != -1);
+    
+    IOUring ring;
+    b32 is_created = CreateIOUring(&ring, queue_depth);
+    assert(is_created);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 submit_offset = 0;
+    u64 completed_size = 0;
+    u32 in_flight_count = 0;
+    while (completed_size < buffer->size)
+    {
+        u32 submit_count = 0;
+        u32 sq_tail = *ring.sq_tail;
+        while ((in_flight_count < queue_depth) && (submit_offset < buffer->size))
+        {
+            u64 size = buffer->size - submit_offset;
+            if (size > READ_CHUNK_SIZE)
+                size = READ_CHUNK_SIZE;
+            
+            u32 idx = sq_tail & *ring.sq_mask;
+            io_uring_sqe *sqe = ring.sqes + idx;
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = file;
+            sqe->off = submit_offset;
+            sqe->addr = (u64)(buffer->data + submit_offset);
+            sqe->len = (u32)size;
+            sqe->user_data = size;
+            ring.sq_array[idx] = idx;
+            
+            ++sq_tail;
+            ++submit_count;
+            ++in_flight_count;
+            submit_offset += size;
+        }
+        __atomic_store_n(ring.sq_tail, sq_tail, __ATOMIC_RELEASE);
+        
+        int retval = (int)syscall(__NR_io_uring_enter, ring.fd, submit_count, 1, IORING_ENTER_GETEVENTS, 0, 0);
+        assert(retval >= 0);
+        
+        u32 cq_head = *ring.cq_head;
+        u32 cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; ++cq_head)
+        {
+            io_uring_cqe *cqe = ring.cqes + (cq_head & *ring.cq_mask);
+            
+            // NOTE(achal): Short reads only happen at the end of a file, which we never read past.
+            assert((u64)cqe->res == cqe->user_data);
+            completed_size += cqe->user_data;
+            --in_flight_count;
+        }
+        __atomic_store_n(ring.cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+    EndTime(&time_data);
+    
+    DestroyIOUring(&ring);
+    close(file);
+    ChecksumRepTestOutput(&time_data, buffer->data, buffer->size);
+    return time_data;
+}
+
+FILE_READ_TEST(io_uring_qd1)
+{
+    return ReadWithIOUring(params, buffer, 1);
+}
+
+FILE_READ_TEST(io_uring_qd4)
+{
+    return ReadWithIOUring(params, buffer, 4);
+}
+
+FILE_READ_TEST(io_uring_qd16)
+{
+    return ReadWithIOUring(params, buffer, 16);
+}
+#endif
+
+// NOTE(achal): By default the whole file is read, --size reads only that much of it.
+static b32 SetUp(RepTesterConfig *config, TestParams *params, Buffer *reuse_buffer)
+{
+    params->path = config->input;
+    
+    FILE *input_file = fopen(config->input, "rb");
+    if (!input_file)
+    {
+        fprintf(stderr, "ERROR: Unable to open %s\n", config->input);
+        return 0;
+    }
+    fclose(input_file);
+    
+    u64 file_size = GetFileSize(config->input);
+    
+    // NOTE(achal): Page aligned, so that read_direct can read straight into it.
+    Buffer request = {};
+    request.size = (config->size && (config->size < file_size)) ? config->size : file_size;
+    *reuse_buffer = HandleAllocation(AllocationMode_aligned4K, &request);
+    
+#ifdef __linux__
+    // NOTE(achal): Not every file system supports O_DIRECT (tmpfs doesn't), and io_uring may be disabled.
+    int file = open(config->input, O_RDONLY|O_DIRECT);
+    if (file == -1)
+    {
+        fprintf(stderr, "WARNING: %s can't be opened with O_DIRECT, skipping read_direct\n", config->input);
+        UnregisterRepTest("read_direct");
+        UnregisterRepTest("read_direct_cold");
+    }
+    else
+    {
+        close(file);
+    }
+    
+    IOUring ring;
+    if (CreateIOUring(&ring, 1))
+    {
+        DestroyIOUring(&ring);
+    }
+    else
+    {
+        fprintf(stderr, "WARNING: io_uring is unavailable, skipping the io_uring tests\n");
+        UnregisterRepTest("io_uring_qd1");
+        UnregisterRepTest("io_uring_qd4");
+        UnregisterRepTest("io_uring_qd16");
+        UnregisterRepTest("io_uring_qd1_cold");
+        UnregisterRepTest("io_uring_qd4_cold");
+        UnregisterRepTest("io_uring_qd16_cold");
+    }
+    
+    EvictFromPageCache(config->input);
+    f64 residency = GetPageCacheResidency(config->input);
+    if (residency > 0.1)
+        fprintf(stderr, "WARNING: %.0f%% of %s stayed in the page cache after eviction, the cold tests won't be cold\n", residency*100.0, config->input);
+#endif
+    
+    return (reuse_buffer->data != 0);
+}
+
+// NOTE(achal): Medians, the minimum of a cold test is whichever repetition the device happened to serve
+// fastest.
+static void PrintWarmColdSummary()
+{
+    b32 has_header = 0;
+    f64 cpu_freq = (f64)GetCPUTimerFrequency();
+    
+    for (u32 cold_idx = 0; cold_idx < g_RepTestResultCount; ++cold_idx)
+    {
+        RepTestResult *cold = g_RepTestResults + cold_idx;
+        u64 name_length = strlen(cold->name);
+        if ((name_length < 5) || (strcmp(cold->name + name_length - 5, "_cold") != 0))
+            continue;
+        
+        for (u32 warm_idx = 0; warm_idx < g_RepTestResultCount; ++warm_idx)
+        {
+            RepTestResult *warm = g_RepTestResults + warm_idx;
+            if ((strlen(warm->name) != name_length-5) || (strncmp(warm->name, cold->name, name_length-5) != 0))
+                continue;
+            if ((warm->alloc_mode != cold->alloc_mode) || (warm->thread_count != cold->thread_count) || (warm->repeat_idx != cold->repeat_idx))
+                continue;
+            
+            if (!has_header)
+            {
+                printf("\nTest, Alloc mode, Threads, Warm GB/s, Cold GB/s, Cold/Warm time\n");
+                has_header = 1;
+            }
+            
+            f64 warm_gbps = ((f64)warm->bytes_processed/(1024.0*1024.0*1024.0))/(warm->median/cpu_freq);
+            f64 cold_gbps = ((f64)cold->bytes_processed/(1024.0*1024.0*1024.0))/(cold->median/cpu_freq);
+            printf("%s, %s, %u, %.3f, %.3f, %.2fx\n", warm->name, g_AllocationModeNames[warm->alloc_mode], warm->thread_count, warm_gbps, cold_gbps, cold->median/warm->median);
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static TestParams test_params;
+    RepTesterConfig config = DefaultRepTesterConfig(10.0, 0, "data/haversine_input_10000000.json");
+    int result = RepTestMain(argc, argv, &config, SetUp, &test_params);
+    
+    PrintWarmColdSummary();
+    
+    return result;
+}
@@ -0,0 +1,489 @@
+#include "rep_tester.h"
+
+#ifdef _WIN32
+#include <io.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+#include <fcntl.h>
+
+struct TestParams
+{
+    char const *path;
+    b32 created_output;
+};
+
+/*
+NOTE(achal):
+Writes the buffer out to --input (which is the output file here, data/rep_test_file_write.bin by default,
+deleted at the end) in different ways, to pick how haversine_generator should write its output. The file
+is deleted before every repetition, outside the timed interval, so that each one allocates its blocks
+anew rather than overwriting the last one's (truncating an existing file instead would also make ext4
+flush it on close).
+
+Without a sync a write is done once the data is copied into the page cache, the device gets it whenever
+the kernel gets around to it, which the next repetitions may end up paying for. So on Linux each test is
+registered three times by FILE_WRITE_TEST: as is, as <name>_fdatasync which waits for the data (and the
+metadata needed to read it back) to be on the device, and as <name>_fsync which waits for all of the
+metadata as well. The sync is part of the timed interval. On Windows there is only <name>_fsync (_commit).
+
+The summary at the end puts the three side by side, along with the page faults of the unsynced one.
+*/
+
+enum SyncMode
+{
+    SyncMode_None,
+    SyncMode_fdatasync,
+    SyncMode_fsync,
+};
+
+static void SyncFile(int file, SyncMode sync)
+{
+#ifdef _WIN32
+    if (sync != SyncMode_None)
+        _commit(file);
+#else
+    if (sync == SyncMode_fdatasync)
+        fdatasync(file);
+    else if (sync == SyncMode_fsync)
+        fsync(file);
+#endif
+}
+
+// NOTE(achal): stdio's buffer has to go out first.
+static void SyncFILE(FILE *file, SyncMode sync)
+{
+    fflush(file);
+#ifdef _WIN32
+    SyncFile(_fileno(file), sync);
+#else
+    SyncFile(fileno(file), sync);
+#endif
+}
+
+#ifdef __linux__
+#define FILE_WRITE_TEST(name) \
+static TimeTrackedData FileWriteTest_##name(TestParams *params, Buffer *buffer, SyncMode sync); \
+REP_TEST(name) \
+{ \
+    return FileWriteTest_##name(params, buffer, SyncMode_None); \
+} \
+REP_TEST(name##_fdatasync) \
+{ \
+    return FileWriteTest_##name(params, buffer, SyncMode_fdatasync); \
+} \
+REP_TEST(name##_fsync) \
+{ \
+    return FileWriteTest_##name(params, buffer, SyncMode_fsync); \
+} \
+static TimeTrackedData FileWriteTest_##name(TestParams *params, Buffer *buffer, SyncMode sync)
+#else
+#define FILE_WRITE_TEST(name) \
+static TimeTrackedData FileWriteTest_##name(TestParams *params, Buffer *buffer, SyncMode sync); \
+REP_TEST(name) \
+{ \
+    return FileWriteTest_##name(params, buffer, SyncMode_None); \
+} \
+REP_TEST(name##_fsync) \
+{ \
+    return FileWriteTest_##name(params, buffer, SyncMode_fsync); \
+} \
+static TimeTrackedData FileWriteTest_##name(TestParams *params, Buffer *buffer, SyncMode sync)
+#endif
+
+// NOTE(achal): Roughly one line of the haversine JSON, the way the generator hands its output to stdio.
+#define WRITE_RECORD_SIZE 64
+
+static FILE *CreateOutputFILE(char const *path)
+{
+    remove(path);
+    FILE *file = fopen(path, "wb");
+    assert(file);
+    return file;
+}
+
+static TimeTrackedData WriteRecords(TestParams *params, Buffer *buffer, SyncMode sync, u64 stdio_buffer_size)
+{
+    FILE *file = CreateOutputFILE(params->path);
+    setvbuf(file, 0, _IOFBF, stdio_buffer_size);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 offset = 0;
+    while (offset < buffer->size)
+    {
+        u64 size = buffer->size - offset;
+        if (size > WRITE_RECORD_SIZE)
+            size = WRITE_RECORD_SIZE;
+        
+        size_t retval = fwrite(buffer->data + offset, 1, size, file);
+        assert(retval == size);
+        offset += size;
+    }
+    SyncFILE(file, sync);
+    EndTime(&time_data);
+    
+    fclose(file);
+    assert(GetFileSize(params->path) == buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): One call for the whole buffer, which stdio hands straight to the OS.
+FILE_WRITE_TEST(fwrite)
+{
+    FILE *file = CreateOutputFILE(params->path);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    size_t retval = fwrite(buffer->data, 1, buffer->size, file);
+    SyncFILE(file, sync);
+    EndTime(&time_data);
+    
+    assert(retval == buffer->size);
+    
+    fclose(file);
+    assert(GetFileSize(params->path) == buffer->size);
+    return time_data;
+}
+
+FILE_WRITE_TEST(fwrite_records_4KB)
+{
+    return WriteRecords(params, buffer, sync, 4*1024);
+}
+
+FILE_WRITE_TEST(fwrite_records_64KB)
+{
+    return WriteRecords(params, buffer, sync, 64*1024);
+}
+
+FILE_WRITE_TEST(fwrite_records_1MB)
+{
+    return WriteRecords(params, buffer, sync, 1024*1024);
+}
+
+#ifdef __linux__
+#define WRITE_CHUNK_SIZE (1024*1024)
+#define MAX_WRITE_CALL_SIZE 0x7FFFF000ull
+
+// NOTE(achal): Same as for reads, 4K covers the alignment O_DIRECT needs for the buffer, offset and size.
+#define DIRECT_IO_ALIGNMENT 4096
+
+static int CreateOutputFile(char const *path, int flags)
+{
+    unlink(path);
+    int file = open(path, O_CREAT|flags, 0644);
+    assert(file != -1);
+    return file;
+}
+
+static void CloseOutputFile(char const *path, int file, u64 size)
+{
+    close(file);
+    assert(GetFileSize(path) == size);
+}
+
+static void WriteChunked(int file, u8 *data, u64 size, u64 chunk_size)
+{
+    u64 offset = 0;
+    while (offset < size)
+    {
+        u64 write_size = size - offset;
+        if (write_size > chunk_size)
+            write_size = chunk_size;
+        
+        ssize_t retval = write(file, data + offset, write_size);
+        assert(retval > 0);
+        offset += (u64)retval;
+    }
+}
+
+FILE_WRITE_TEST(write)
+{
+    int file = CreateOutputFile(params->path, O_WRONLY);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    WriteChunked(file, buffer->data, buffer->size, MAX_WRITE_CALL_SIZE);
+    SyncFile(file, sync);
+    EndTime(&time_data);
+    
+    CloseOutputFile(params->path, file, buffer->size);
+    return time_data;
+}
+
+FILE_WRITE_TEST(write_chunked)
+{
+    int file = CreateOutputFile(params->path, O_WRONLY);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    WriteChunked(file, buffer->data, buffer->size, WRITE_CHUNK_SIZE);
+    SyncFile(file, sync);
+    EndTime(&time_data);
+    
+    CloseOutputFile(params->path, file, buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): In chunks, each at its own offset, the way several writers would fill one file.
+FILE_WRITE_TEST(pwrite)
+{
+    int file = CreateOutputFile(params->path, O_WRONLY);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 offset = 0;
+    while (offset < buffer->size)
+    {
+        u64 write_size = buffer->size - offset;
+        if (write_size > WRITE_CHUNK_SIZE)
+            write_size = WRITE_CHUNK_SIZE;
+        
+        ssize_t retval = pwrite(file, buffer->data + offset, write_size, (off_t)offset);
+        assert(retval > 0);
+        offset += (u64)retval;
+    }
+    SyncFile(file, sync);
+    EndTime(&time_data);
+    
+    CloseOutputFile(params->path, file, buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): Reserves all the blocks up front, so that the writes only copy.
+FILE_WRITE_TEST(write_fallocate)
+{
+    int file = CreateOutputFile(params->path, O_WRONLY);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    int retval = fallocate(file, 0, 0, (off_t)buffer->size);
+    assert(retval == 0);
+    WriteChunked(file, buffer->data, buffer->size, MAX_WRITE_CALL_SIZE);
+    SyncFile(file, sync);
+    EndTime(&time_data);
+    
+    CloseOutputFile(params->path, file, buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): The file is sized with ftruncate and written through a shared mapping, every page of which
+// faults on the first write. Synced, msync(MS_SYNC) writes the pages back before the sync proper. The munmap
+// is timed, as for mmap reads.
+FILE_WRITE_TEST(mmap)
+{
+    int file = CreateOutputFile(params->path, O_RDWR);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    int retval = ftruncate(file, (off_t)buffer->size);
+    assert(retval == 0);
+    u8 *data = (u8 *)mmap(0, buffer->size, PROT_READ|PROT_WRITE, MAP_SHARED, file, 0);
+    assert(data != MAP_FAILED);
+    memcpy(data, buffer->data, buffer->size);
+    if (sync != SyncMode_None)
+    {
+        msync(data, buffer->size, MS_SYNC);
+        SyncFile(file, sync);
+    }
+    munmap(data, buffer->size);
+    EndTime(&time_data);
+    
+    CloseOutputFile(params->path, file, buffer->size);
+    return time_data;
+}
+
+// NOTE(achal): Bypasses the page cache, so even unsynced the data is on its way to the device when write
+// returns (the metadata isn't, hence the synced variants). Like read_direct, aligned blocks go straight out
+// of the buffer when it's aligned and everything else through an aligned bounce chunk. The partial block at
+// the end is written padded and the file is truncated back to size afterwards.
+FILE_WRITE_TEST(write_direct)
+{
+    int file = CreateOutputFile(params->path, O_WRONLY|O_DIRECT);
+    
+    u8 *bounce = (u8 *)aligned_alloc(DIRECT_IO_ALIGNMENT, WRITE_CHUNK_SIZE);
+    assert(bounce);
+    memset(bounce, 0, WRITE_CHUNK_SIZE);
+    
+    b32 is_buffer_aligned = (((u64)buffer->data % DIRECT_IO_ALIGNMENT) == 0);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 offset = 0;
+    while (offset < buffer->size)
+    {
+        u64 size = buffer->size - offset;
+        if (size > WRITE_CHUNK_SIZE)
+            size = WRITE_CHUNK_SIZE;
+        
+        u64 aligned_size = is_buffer_aligned ? (size & ~(u64)(DIRECT_IO_ALIGNMENT-1)) : 0;
+        if (aligned_size)
+        {
+            ssize_t retval = pwrite(file, buffer->data + offset, aligned_size, (off_t)offset);
+            assert(retval == (ssize_t)aligned_size);
+            size = aligned_size;
+        }
+        else
+        {
+            u64 padded_size = AlignUp(size, DIRECT_IO_ALIGNMENT);
+            memcpy(bounce, buffer->data + offset, size);
+            memset(bounce + size, 0, padded_size - size);
+            ssize_t retval = pwrite(file, bounce, padded_size, (off_t)offset);
+            assert(retval == (ssize_t)padded_size);
+        }
+        
+        offset += size;
+    }
+    if ((buffer->size % DIRECT_IO_ALIGNMENT) != 0)
+    {
+        int retval = ftruncate(file, (off_t)buffer->size);
+        assert(retval == 0);
+    }
+    SyncFile(file, sync);
+    EndTime(&time_data);
+    
+    free(bounce);
+    CloseOutputFile(params->path, file, buffer->size);
+    return time_data;
+}
+#endif
+
+// NOTE(achal): --size is how much gets written, 256MB by default. The buffer is filled (and so touched)
+// here, the malloc runs write out of untouched pages instead.
+static b32 SetUp(RepTesterConfig *config, TestParams *params, Buffer *reuse_buffer)
+{
+    params->path = config->input;
+    
+    FILE *file = fopen(config->input, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "ERROR: Unable to create %s\n", config->input);
+        return 0;
+    }
+    fclose(file);
+    params->created_output = 1;
+    
+    // NOTE(achal): Page aligned, so that write_direct can write straight out of it.
+    Buffer request = {};
+    request.size = config->size;
+    *reuse_buffer = HandleAllocation(AllocationMode_aligned4K, &request);
+    if (!reuse_buffer->data)
+        return 0;
+    
+    for (u64 i = 0; i < reuse_buffer->size; ++i)
+        reuse_buffer->data[i] = (u8)i;
+    
+#ifdef __linux__
+    // NOTE(achal): Not every file system supports O_DIRECT (tmpfs doesn't) or fallocate.
+    int fd = open(config->input, O_WRONLY|O_DIRECT);
+    if (fd == -1)
+    {
+        fprintf(stderr, "WARNING: %s can't be opened with O_DIRECT, skipping write_direct\n", config->input);
+        UnregisterRepTest("write_direct");
+        UnregisterRepTest("write_direct_fdatasync");
+        UnregisterRepTest("write_direct_fsync");
+    }
+    else
+    {
+        close(fd);
+    }
+    
+    fd = open(config->input, O_WRONLY);
+    if ((fd == -1) || (fallocate(fd, 0, 0, DIRECT_IO_ALIGNMENT) != 0))
+    {
+        fprintf(stderr, "WARNING: %s doesn't support fallocate, skipping write_fallocate\n", config->input);
+        UnregisterRepTest("write_fallocate");
+        UnregisterRepTest("write_fallocate_fdatasync");
+        UnregisterRepTest("write_fallocate_fsync");
+    }
+    if (fd != -1)
+        close(fd);
+#endif
+    
+    return 1;
+}
+
+static b32 HasSuffix(char const *name, char const *suffix, u64 *prefix_length)
+{
+    u64 name_length = strlen(name);
+    u64 suffix_length = strlen(suffix);
+    if ((name_length < suffix_length) || (strcmp(name + name_length - suffix_length, suffix) != 0))
+        return 0;
+    
+    *prefix_length = name_length - suffix_length;
+    return 1;
+}
+
+// NOTE(achal): Medians. The synced variant of a test is found by its name, run with the same allocation
+// mode, thread count and repeat.
+static void PrintSyncSummary()
+{
+    char const *sync_suffixes[] = {"_fdatasync", "_fsync"};
+    
+    b32 has_header = 0;
+    f64 cpu_freq = (f64)GetCPUTimerFrequency();
+    
+    for (u32 result_idx = 0; result_idx < g_RepTestResultCount; ++result_idx)
+    {
+        RepTestResult *unsynced = g_RepTestResults + result_idx;
+        u64 prefix_length;
+        if (HasSuffix(unsynced->name, "_fdatasync", &prefix_length) || HasSuffix(unsynced->name, "_fsync", &prefix_length))
+            continue;
+        
+        if (!has_header)
+        {
+            printf("\nTest, Alloc mode, Threads, No sync GB/s, fdatasync GB/s, fsync GB/s, Avg page faults\n");
+            has_header = 1;
+        }
+        
+        f64 gigabytes = (f64)unsynced->bytes_processed/(1024.0*1024.0*1024.0);
+        printf("%s, %s, %u, %.3f", unsynced->name, g_AllocationModeNames[unsynced->alloc_mode], unsynced->thread_count, gigabytes/(unsynced->median/cpu_freq));
+        
+        u64 name_length = strlen(unsynced->name);
+        for (u32 suffix_idx = 0; suffix_idx < ArrayCount(sync_suffixes); ++suffix_idx)
+        {
+            RepTestResult *synced = 0;
+            for (u32 synced_idx = 0; synced_idx < g_RepTestResultCount; ++synced_idx)
+            {
+                RepTestResult *candidate = g_RepTestResults + synced_idx;
+                if (!HasSuffix(candidate->name, sync_suffixes[suffix_idx], &prefix_length) || (prefix_length != name_length) || (strncmp(candidate->name, unsynced->name, name_length) != 0))
+                    continue;
+                if ((candidate->alloc_mode != unsynced->alloc_mode) || (candidate->thread_count != unsynced->thread_count) || (candidate->repeat_idx != unsynced->repeat_idx))
+                    continue;
+                
+                synced = candidate;
+                break;
+            }
+            
+            if (synced)
+                printf(", %.3f", gigabytes/(synced->median/cpu_freq));
+            else
+                printf(", -");
+        }
+        
+        printf(", %.1f\n", unsynced->avg_page_fault_count);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static TestParams test_params;
+    RepTesterConfig config = DefaultRepTesterConfig(10.0, 256ull*1024*1024, "data/rep_test_file_write.bin");
+    int result = RepTestMain(argc, argv, &config, SetUp, &test_params);
+    
+    PrintSyncSummary();
+    
+    // NOTE(achal): Only SetUp creates the file, and it isn't called for --list or when the options don't parse.
+    if (test_params.created_output)
+        remove(config.input);
+    
+    return result;
+}
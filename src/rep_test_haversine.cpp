@@ -0,0 +1,217 @@
+#include "rep_tester.h"
+#include "haversine_lib.h"
+
+/*
+NOTE(achal):
+Repetition tests for the stages of the haversine program, see haversine_lib.h. Everything a stage
+needs (the JSON, the parsed pairs, the offsets of all numbers in the JSON, the reference answers) is
+loaded up front, so that only the stage itself is timed. The buffer handed to the tests is where
+ParsePairs writes its output, so the allocation modes show what faulting in the pair array costs.
+*/
+
+struct TestParams
+{
+    u8 *json_data;
+    u64 json_size;
+    
+    u64 number_count;
+    u64 number_bytes;
+    u64 *number_offsets;
+    
+    u64 pair_count;
+    HaversinePair *pairs;
+    f64 *answers;
+};
+
+REP_TEST(Tokenize)
+{
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 line_count = TokenizeJSONLines(params->json_data, params->json_size);
+    DoNotOptimize(&line_count);
+    EndTime(&time_data);
+    
+    SetRepTestChecksum(&time_data, line_count);
+    time_data.bytes_processed = params->json_size;
+    return time_data;
+}
+
+REP_TEST(ParseF64)
+{
+    TimeTrackedData time_data = {};
+    
+    f64 sum = 0.0;
+    BeginTime(&time_data);
+    for (u64 i = 0; i < params->number_count; ++i)
+        sum += ParseF64FromString((char *)params->json_data + params->number_offsets[i], 0);
+    DoNotOptimize(&sum);
+    EndTime(&time_data);
+    
+    u64 sum_bits;
+    memcpy(&sum_bits, &sum, sizeof(sum_bits));
+    SetRepTestChecksum(&time_data, sum_bits);
+    time_data.bytes_processed = params->number_bytes;
+    return time_data;
+}
+
+REP_TEST(ParsePairs)
+{
+    HaversinePair *pairs = (HaversinePair *)buffer->data;
+    u64 max_pair_count = buffer->size/sizeof(HaversinePair);
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 pair_count = ParseHaversinePairs(params->json_data, params->json_size, pairs, max_pair_count, 0);
+    DoNotOptimize(pairs);
+    EndTime(&time_data);
+    
+    // NOTE(achal): This is a plain REP_TEST, so it always gets the whole buffer, even under --threads.
+    assert(pair_count == params->pair_count);
+    ChecksumRepTestOutput(&time_data, pairs, pair_count*sizeof(HaversinePair));
+    time_data.bytes_processed = params->json_size;
+    return time_data;
+}
+
+REP_TEST(SumHaversine)
+{
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    f64 sum = SumHaversineDistances(params->pairs, params->pair_count);
+    DoNotOptimize(&sum);
+    EndTime(&time_data);
+    
+    u64 sum_bits;
+    memcpy(&sum_bits, &sum, sizeof(sum_bits));
+    SetRepTestChecksum(&time_data, sum_bits);
+    time_data.bytes_processed = params->pair_count*sizeof(HaversinePair);
+    return time_data;
+}
+
+REP_TEST(Validate)
+{
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    u64 mismatch_count = ValidateHaversineDistances(params->pairs, params->pair_count, params->answers, 1e-10);
+    DoNotOptimize(&mismatch_count);
+    EndTime(&time_data);
+    
+    SetRepTestChecksum(&time_data, mismatch_count);
+    time_data.bytes_processed = params->pair_count*(sizeof(HaversinePair) + sizeof(f64));
+    return time_data;
+}
+
+static u8 *ReadEntireFile(char const *path, u64 *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    
+    u64 file_size = GetFileSize(path);
+    u8 *data = (u8 *)malloc(file_size);
+    assert(data);
+    
+    *size = fread(data, 1, file_size, file);
+    fclose(file);
+    
+    return data;
+}
+
+// NOTE(achal): haversine_generator writes haversine.json and haversine_answers.f64 into the working directory.
+// Renamed to haversine_input_<n>.json, as the haversine program's usage suggests, the answers are looked for
+// at haversine_answers_<n>.f64, otherwise at haversine_answers.f64, in the same directory as the input.
+static void GetAnswersPath(char const *input_path, char *answers_path, u32 answers_path_size)
+{
+    char const *file_name = input_path;
+    for (char const *c = input_path; *c; ++c)
+    {
+        if ((*c == '/') || (*c == '\\'))
+            file_name = c + 1;
+    }
+    
+    int directory_length = (int)(file_name - input_path);
+    char const *extension = strrchr(file_name, '.');
+    
+    char const *input_tag = "haversine_input_";
+    u32 input_tag_length = (u32)strlen(input_tag);
+    if (extension && (strncmp(file_name, input_tag, input_tag_length) == 0))
+    {
+        char const *count_begin = file_name + input_tag_length;
+        snprintf(answers_path, answers_path_size, "%.*shaversine_answers_%.*s.f64", directory_length, input_path, (int)(extension - count_begin), count_begin);
+    }
+    else
+    {
+        snprintf(answers_path, answers_path_size, "%.*shaversine_answers.f64", directory_length, input_path);
+    }
+}
+
+static b32 SetUp(RepTesterConfig *config, TestParams *params, Buffer *reuse_buffer)
+{
+    params->json_data = ReadEntireFile(config->input, &params->json_size);
+    if (!params->json_data)
+    {
+        fprintf(stderr, "ERROR: Failed to read %s\n", config->input);
+        return 0;
+    }
+    
+    // NOTE(achal): Every value follows a ": ", the keys ("pairs") are followed by a '['.
+    u64 max_number_count = 0;
+    for (u64 i = 0; i+2 < params->json_size; ++i)
+        max_number_count += (params->json_data[i] == ':');
+    
+    params->number_offsets = (u64 *)malloc(max_number_count*sizeof(u64));
+    assert(params->number_offsets);
+    for (u64 i = 0; i+2 < params->json_size; ++i)
+    {
+        u8 *c = params->json_data + i;
+        if ((c[0] == ':') && (c[1] == ' ') && ((c[2] == '-') || isdigit(c[2])))
+        {
+            u64 offset = i+2;
+            params->number_offsets[params->number_count++] = offset;
+            
+            u64 length = 0;
+            while ((offset + length < params->json_size) && (params->json_data[offset + length] != ',') && (params->json_data[offset + length] != '}') && (params->json_data[offset + length] != '\n'))
+                ++length;
+            params->number_bytes += length;
+        }
+    }
+    
+    // NOTE(achal): ParseHaversinePairs takes at most one pair from a line, so the line count is a bound that
+    // never truncates.
+    u64 max_pair_count = TokenizeJSONLines(params->json_data, params->json_size);
+    params->pairs = (HaversinePair *)malloc(max_pair_count*sizeof(HaversinePair));
+    assert(params->pairs);
+    params->pair_count = ParseHaversinePairs(params->json_data, params->json_size, params->pairs, max_pair_count, 0);
+    
+    // NOTE(achal): Every pair has its own "x0" key, anything short of that was not parsed.
+    u64 key_count = 0;
+    for (u64 i = 0; i+4 <= params->json_size; ++i)
+        key_count += (memcmp(params->json_data + i, "\"x0\"", 4) == 0);
+    if (key_count != params->pair_count)
+    {
+        fprintf(stderr, "ERROR: Parsed %llu pairs, but %s has %llu\n", params->pair_count, config->input, key_count);
+        return 0;
+    }
+    
+    char answers_path[512];
+    GetAnswersPath(config->input, answers_path, sizeof(answers_path));
+    
+    u64 answers_size = 0;
+    params->answers = answers_path[0] ? (f64 *)ReadEntireFile(answers_path, &answers_size) : 0;
+    if (!params->answers || (answers_size != params->pair_count*sizeof(f64)))
+    {
+        fprintf(stderr, "WARNING: No answers at \"%s\", skipping Validate\n", answers_path);
+        UnregisterRepTest("Validate");
+    }
+    
+    printf("Input: %s, %llu pairs, %llu numbers\n", config->input, params->pair_count, params->number_count);
+    
+    reuse_buffer->size = params->pair_count*sizeof(HaversinePair);
+    reuse_buffer->data = (u8 *)malloc(reuse_buffer->size);
+    return 1;
+}
+
+REP_TEST_MAIN(10.0, 0, "data/haversine_input_10000000.json", SetUp)
@@ -0,0 +1,186 @@
+#include "rep_tester.h"
+
+/*
+NOTE(achal):
+Streams the whole input through one small buffer, reused for every chunk, instead of reading it into
+one allocation the size of the file (like rep_test_file_read does), and sums each chunk as it arrives
+the way a streaming parser would consume it. The chunk size is swept in powers of two from 4KB up to
+--size (64MB by default), and the last row reads the whole file into a single buffer for comparison.
+
+Small chunks pay a syscall per chunk, big ones fall out of the cache between the read and the sum.
+The smallest chunk size within 5% of the best is printed as the point where the syscall overhead stops
+mattering, next to the cache sizes the OS reports.
+
+Output is CSV on stdout, one row per chunk size. It's a sweep (see RunRepTestSweepPoint), --json and
+--baseline work per chunk size, the whole file row is named "whole".
+*/
+
+struct TestParams
+{
+    char const *path;
+    u64 file_size;
+};
+
+#define MAX_CHUNK_SIZE_COUNT 64
+
+// NOTE(achal): Unbuffered, so that each fread is one read straight into the chunk rather than a copy out
+// of stdio's own buffer.
+REP_TEST(fread_sum)
+{
+    FILE *file = fopen(params->path, "rb");
+    assert(file);
+    setvbuf(file, 0, _IONBF, 0);
+    
+    u64 *chunk = (u64 *)buffer->data;
+    
+    TimeTrackedData time_data = {};
+    
+    u64 sum = 0;
+    BeginTime(&time_data);
+    u64 size_remaining = params->file_size;
+    while (size_remaining)
+    {
+        u64 read_size = (size_remaining < buffer->size) ? size_remaining : buffer->size;
+        size_t retval = fread(chunk, 1, read_size, file);
+        assert(retval == read_size);
+        
+        // NOTE(achal): The tail of the last chunk is left over from the one before, which doesn't
+        // matter for a checksum that's only compared against itself.
+        u64 count = (read_size + sizeof(u64) - 1)/sizeof(u64);
+        for (u64 i = 0; i < count; ++i)
+            sum += chunk[i];
+        
+        size_remaining -= read_size;
+    }
+    DoNotOptimize(&sum);
+    EndTime(&time_data);
+    
+    fclose(file);
+    
+    SetRepTestChecksum(&time_data, sum);
+    time_data.bytes_processed = params->file_size;
+    return time_data;
+}
+
+static void PrintSize(u64 size)
+{
+    if (size >= 1024ull*1024*1024)
+        printf("%.2f GB", (f64)size/(1024.0*1024.0*1024.0));
+    else if (size >= 1024ull*1024)
+        printf("%.2f MB", (f64)size/(1024.0*1024.0));
+    else
+        printf("%.2f KB", (f64)size/1024.0);
+}
+
+int main(int argc, char **argv)
+{
+    RepTesterConfig config = DefaultRepTesterConfig(1.0, 64ull*1024*1024, "data/haversine_input_10000000.json");
+    if (!ParseRepTestSweepCommandLine(argc, argv, &config))
+        return -1;
+    if (config.list_only)
+        return ListRepTests(&config);
+    
+    FILE *input_file = fopen(config.input, "rb");
+    if (!input_file)
+    {
+        fprintf(stderr, "ERROR: Unable to open %s\n", config.input);
+        return -1;
+    }
+    fclose(input_file);
+    
+    TestParams test_params = {};
+    test_params.path = config.input;
+    test_params.file_size = GetFileSize(config.input);
+    
+    // NOTE(achal): Chunks larger than the file would read the same as the whole file row.
+    u64 chunk_sizes[MAX_CHUNK_SIZE_COUNT];
+    u32 chunk_size_count = 0;
+    for (u64 size = 4096; (size <= config.size) && (size < test_params.file_size) && (chunk_size_count+1 < MAX_CHUNK_SIZE_COUNT); size *= 2)
+        chunk_sizes[chunk_size_count++] = size;
+    chunk_sizes[chunk_size_count++] = AlignUp(test_params.file_size, sizeof(u64));
+    
+    // NOTE(achal): Pre-touched, the chunk buffer is reused for the whole run so its page faults aren't
+    // part of what we're measuring.
+    Buffer reuse_buffer = {};
+    reuse_buffer.size = chunk_sizes[chunk_size_count-1];
+    reuse_buffer.data = (u8 *)malloc(reuse_buffer.size);
+    memset(reuse_buffer.data, 0, reuse_buffer.size);
+    
+    RepTester rep_tester;
+    if (!BeginRepTestSweep(&rep_tester, &config, &reuse_buffer))
+        return -1;
+    
+    // NOTE(achal): Too big for the stack.
+    static RepTestStats stats;
+    
+    for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+    {
+        TestFunction *test_function = g_RepTests + fn_idx;
+        if (!IsRepTestSelected(&config, test_function))
+            continue;
+        
+        printf("\n%s of ", test_function->name);
+        PrintSize(test_params.file_size);
+        printf(" from %s\n", config.input);
+        printf("Chunk size, Min GB/s, Median GB/s, Avg page faults\n");
+        
+        f64 median_gbps[MAX_CHUNK_SIZE_COUNT];
+        f64 best_gbps = 0.0;
+        for (u32 size_idx = 0; size_idx < chunk_size_count; ++size_idx)
+        {
+            b32 is_whole_file = (size_idx+1 == chunk_size_count);
+            
+            char point[32];
+            if (is_whole_file)
+                snprintf(point, sizeof(point), "whole");
+            else
+                snprintf(point, sizeof(point), "%llu", chunk_sizes[size_idx]);
+            
+            rep_tester.reuse_buffer.size = chunk_sizes[size_idx];
+            RunRepTestSweepPoint(&rep_tester, test_function, &test_params, point, &stats);
+            
+            f64 gigabytes = (f64)stats.bytes_processed/(1024.0*1024.0*1024.0);
+            f64 min_gbps = gigabytes/((f64)stats.min.time/(f64)rep_tester.cpu_freq);
+            median_gbps[size_idx] = gigabytes/(stats.median/(f64)rep_tester.cpu_freq);
+            f64 page_fault_count = (f64)stats.sum.data.page_fault_count/(f64)stats.test_count;
+            
+            if (is_whole_file)
+                printf("whole file (%llu)", chunk_sizes[size_idx]);
+            else
+                printf("%llu", chunk_sizes[size_idx]);
+            printf(", %.3f, %.3f, %.1f\n", min_gbps, median_gbps[size_idx], page_fault_count);
+            fflush(stdout);
+            
+            if (!is_whole_file && (median_gbps[size_idx] > best_gbps))
+                best_gbps = median_gbps[size_idx];
+        }
+        
+        // NOTE(achal): Medians rather than minimums, a streaming reader lives with the typical case.
+        for (u32 size_idx = 0; size_idx+1 < chunk_size_count; ++size_idx)
+        {
+            if (median_gbps[size_idx] >= 0.95*best_gbps)
+            {
+                printf("\nWithin 5%% of the best chunked rate (%.3f GB/s) from ", best_gbps);
+                PrintSize(chunk_sizes[size_idx]);
+                printf(" on, the whole file at once: %.3f GB/s\n", median_gbps[chunk_size_count-1]);
+                break;
+            }
+        }
+    }
+    
+    u64 cache_sizes[3];
+    GetOSCacheSizes(cache_sizes);
+    char const *level_names[] = {"L1", "L2", "L3"};
+    printf("Reported caches:");
+    for (u32 level_idx = 0; level_idx < ArrayCount(level_names); ++level_idx)
+    {
+        if (!cache_sizes[level_idx])
+            continue;
+        
+        printf(" %s ", level_names[level_idx]);
+        PrintSize(cache_sizes[level_idx]);
+    }
+    printf("\n");
+    
+    return EndRepTester(&rep_tester);
+}
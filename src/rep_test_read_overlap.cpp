@@ -0,0 +1,370 @@
+#include "rep_tester.h"
+#include "haversine_lib.h"
+
+/*
+NOTE(achal):
+How much of the cost of reading a file can be hidden behind processing it. A reader thread streams the
+input into a ring of buffers while the test thread consumes each one as soon as it's full, with one of
+the kernels below. The consumer only ever hands whole lines to a kernel: the partial line at the end of a
+buffer is carried over and put in front of the next one, in the space kept free before each buffer.
+
+Each kernel is run for every buffer size (powers of four from 64KB up to --size, 4MB by default) at
+every ring depth, and serially: read a buffer, process it, read the next, on one thread. ReadOnly does no
+work on the buffers, so it's how fast the reader alone can go.
+
+Output is CSV on stdout, GB/s (median) per buffer size and ring depth, followed by how much of the read
+time the best ring hid, for each kernel: (serial - overlapped)/ReadOnly's serial time, negative when even
+the best ring is slower than serial. It's a sweep (see RunRepTestSweepPoint), --json and --baseline work
+per kernel, buffer size and depth, named e.g. Tokenize/1024KB/depth4 (depth0 is serial).
+*/
+
+struct TestParams
+{
+    char const *path;
+    u64 file_size;
+    
+    u64 buffer_size;
+    u32 ring_depth; // 0: serial, no reader thread
+    s32 reader_cpu; // -1: not pinned
+};
+
+#define MAX_RING_DEPTH 16
+#define MAX_BUFFER_SIZE_COUNT 16
+
+// NOTE(achal): Longest line a kernel may be handed, haversine lines are well below it.
+#define MAX_LINE_SIZE 1024
+
+typedef u64 ConsumeProc(u8 *data, u64 size);
+
+struct RingSlot
+{
+    u8 *data;
+    u64 size; // 0 once the file is done
+    u32 volatile is_full;
+};
+
+struct OverlappedRead
+{
+    FILE *file;
+    u64 buffer_size;
+    u32 ring_depth;
+    s32 cpu;
+    
+    u32 volatile should_start;
+    RingSlot slots[MAX_RING_DEPTH];
+};
+
+static OS_THREAD_PROC(ReaderThreadProc)
+{
+    OverlappedRead *read = (OverlappedRead *)param;
+    if (read->cpu >= 0)
+        PinCurrentThreadToCPU((u32)read->cpu);
+    
+    u32 spin_count = 0;
+    while (!AtomicLoadU32(&read->should_start))
+        SpinWait(&spin_count);
+    
+    for (u64 chunk_idx = 0;; ++chunk_idx)
+    {
+        RingSlot *slot = read->slots + (chunk_idx % read->ring_depth);
+        
+        spin_count = 0;
+        while (AtomicLoadU32(&slot->is_full))
+            SpinWait(&spin_count);
+        
+        slot->size = fread(slot->data, 1, read->buffer_size, read->file);
+        AtomicStoreU32(&slot->is_full, 1);
+        
+        if (!slot->size)
+            break;
+    }
+    
+    return 0;
+}
+
+// NOTE(achal): Hands the whole lines of [data, data+size) to consume, with the carried over partial line
+// from before in front of them, and carries over the partial line at the end. data must have
+// MAX_LINE_SIZE bytes of space in front of it.
+static u64 ConsumeLines(ConsumeProc *consume, u8 *data, u64 size, u8 *carry, u64 *carry_size)
+{
+    u64 line_end = size;
+    while (line_end && (data[line_end-1] != '\n'))
+        --line_end;
+    
+    u64 result = 0;
+    if (line_end)
+    {
+        u8 *lines = data - *carry_size;
+        memcpy(lines, carry, *carry_size);
+        result = consume(lines, *carry_size + line_end);
+        *carry_size = 0;
+    }
+    
+    u64 rest_size = size - line_end;
+    assert(*carry_size + rest_size < MAX_LINE_SIZE);
+    memcpy(carry + *carry_size, data + line_end, rest_size);
+    *carry_size += rest_size;
+    
+    return result;
+}
+
+// NOTE(achal): The buffer holds ring_depth slots of MAX_LINE_SIZE + buffer_size bytes (just one when
+// serial). The reader thread is started and joined outside the timed interval, which runs from telling
+// it to go until the last buffer has been consumed.
+static TimeTrackedData RunOverlappedRead(TestParams *params, Buffer *buffer, ConsumeProc *consume)
+{
+    // NOTE(achal): Too big for the stack.
+    static OverlappedRead read;
+    memset(&read, 0, sizeof(read));
+    
+    read.file = fopen(params->path, "rb");
+    assert(read.file);
+    setvbuf(read.file, 0, _IONBF, 0);
+    
+    read.buffer_size = params->buffer_size;
+    read.ring_depth = params->ring_depth;
+    read.cpu = params->reader_cpu;
+    
+    u32 slot_count = params->ring_depth ? params->ring_depth : 1;
+    assert(slot_count*(MAX_LINE_SIZE + params->buffer_size) <= buffer->size);
+    for (u32 slot_idx = 0; slot_idx < slot_count; ++slot_idx)
+        read.slots[slot_idx].data = buffer->data + slot_idx*(MAX_LINE_SIZE + params->buffer_size) + MAX_LINE_SIZE;
+    
+    OSThread reader = {};
+    if (params->ring_depth)
+        reader = CreateOSThread(ReaderThreadProc, &read);
+    
+    u8 carry[MAX_LINE_SIZE+1];
+    u64 carry_size = 0;
+    u64 sum = 0;
+    
+    TimeTrackedData time_data = {};
+    
+    BeginTime(&time_data);
+    if (params->ring_depth)
+    {
+        AtomicStoreU32(&read.should_start, 1);
+        
+        for (u64 chunk_idx = 0;; ++chunk_idx)
+        {
+            RingSlot *slot = read.slots + (chunk_idx % read.ring_depth);
+            
+            u32 spin_count = 0;
+            while (!AtomicLoadU32(&slot->is_full))
+                SpinWait(&spin_count);
+            
+            if (!slot->size)
+                break;
+            
+            sum += ConsumeLines(consume, slot->data, slot->size, carry, &carry_size);
+            AtomicStoreU32(&slot->is_full, 0);
+        }
+    }
+    else
+    {
+        RingSlot *slot = read.slots;
+        while ((slot->size = fread(slot->data, 1, read.buffer_size, read.file)) != 0)
+            sum += ConsumeLines(consume, slot->data, slot->size, carry, &carry_size);
+    }
+    
+    // NOTE(achal): A last line without a newline.
+    if (carry_size)
+    {
+        carry[carry_size++] = '\n';
+        sum += consume(carry, carry_size);
+    }
+    DoNotOptimize(&sum);
+    EndTime(&time_data);
+    
+    if (params->ring_depth)
+        JoinOSThread(reader);
+    fclose(read.file);
+    
+    SetRepTestChecksum(&time_data, sum);
+    time_data.bytes_processed = params->file_size;
+    return time_data;
+}
+
+static u64 ConsumeNothing(u8 *data, u64 size)
+{
+    return size;
+}
+
+static u64 ConsumeChecksum(u8 *data, u64 size)
+{
+    u64 sum = 0;
+    u64 idx = 0;
+    for (; idx+8 <= size; idx += 8)
+    {
+        u64 word;
+        memcpy(&word, data + idx, sizeof(word));
+        sum += word;
+    }
+    for (; idx < size; ++idx)
+        sum += data[idx];
+    
+    return sum;
+}
+
+REP_TEST(ReadOnly)
+{
+    return RunOverlappedRead(params, buffer, ConsumeNothing);
+}
+
+REP_TEST(Checksum)
+{
+    return RunOverlappedRead(params, buffer, ConsumeChecksum);
+}
+
+REP_TEST(Tokenize)
+{
+    return RunOverlappedRead(params, buffer, TokenizeJSONLines);
+}
+
+static void PrintSize(u64 size)
+{
+    if (size >= 1024ull*1024)
+        printf("%.0fMB", (f64)size/(1024.0*1024.0));
+    else
+        printf("%.0fKB", (f64)size/1024.0);
+}
+
+int main(int argc, char **argv)
+{
+    RepTesterConfig config = DefaultRepTesterConfig(0.5, 4ull*1024*1024, "data/haversine_input_10000000.json");
+    if (!ParseRepTestSweepCommandLine(argc, argv, &config))
+        return -1;
+    if (config.list_only)
+        return ListRepTests(&config);
+    
+    FILE *input_file = fopen(config.input, "rb");
+    if (!input_file)
+    {
+        fprintf(stderr, "ERROR: Unable to open %s\n", config.input);
+        return -1;
+    }
+    fclose(input_file);
+    
+    u64 buffer_sizes[MAX_BUFFER_SIZE_COUNT];
+    u32 buffer_size_count = 0;
+    for (u64 size = 64*1024; (size <= config.size) && (buffer_size_count < MAX_BUFFER_SIZE_COUNT); size *= 4)
+        buffer_sizes[buffer_size_count++] = size;
+    
+    if (!buffer_size_count)
+    {
+        fprintf(stderr, "ERROR: --size has to be at least 64KB\n");
+        return -1;
+    }
+    
+    u32 ring_depths[] = {0, 1, 2, 4, 8, 16};
+    
+    // NOTE(achal): Pre-touched, and reused by every run.
+    Buffer reuse_buffer = {};
+    reuse_buffer.size = MAX_RING_DEPTH*(MAX_LINE_SIZE + buffer_sizes[buffer_size_count-1]);
+    reuse_buffer.data = (u8 *)malloc(reuse_buffer.size);
+    if (!reuse_buffer.data)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate %llu bytes\n", reuse_buffer.size);
+        return -1;
+    }
+    memset(reuse_buffer.data, 0, reuse_buffer.size);
+    
+    RepTester rep_tester;
+    if (!BeginRepTestSweep(&rep_tester, &config, &reuse_buffer))
+        return -1;
+    
+    TestParams test_params = {};
+    test_params.path = config.input;
+    test_params.file_size = GetFileSize(config.input);
+    
+    // NOTE(achal): The reader gets a core of its own, the one next to ours, when we're pinned.
+    test_params.reader_cpu = -1;
+    if (rep_tester.environment.pinned_cpu >= 0)
+    {
+        u32 cpu_count = GetOSLogicalProcessorCount();
+        test_params.reader_cpu = (s32)(((u32)rep_tester.environment.pinned_cpu + 1) % cpu_count);
+        if (cpu_count == 1)
+            fprintf(stderr, "WARNING: Only one CPU, the reader and the consumer will take turns on it\n");
+    }
+    
+    // NOTE(achal): Too big for the stack.
+    static RepTestStats stats;
+    static f64 median_times[REP_TESTER_MAX_TESTS][MAX_BUFFER_SIZE_COUNT][ArrayCount(ring_depths)];
+    
+    u32 read_only_idx = g_RepTestCount;
+    for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+    {
+        TestFunction *test_function = g_RepTests + fn_idx;
+        if (!IsRepTestSelected(&config, test_function))
+            continue;
+        
+        if (strcmp(test_function->name, "ReadOnly") == 0)
+            read_only_idx = fn_idx;
+        
+        printf("\n%s, median GB/s\nBuffer size", test_function->name);
+        for (u32 depth_idx = 0; depth_idx < ArrayCount(ring_depths); ++depth_idx)
+        {
+            if (ring_depths[depth_idx])
+                printf(", Depth %u", ring_depths[depth_idx]);
+            else
+                printf(", Serial");
+        }
+        printf("\n");
+        
+        for (u32 size_idx = 0; size_idx < buffer_size_count; ++size_idx)
+        {
+            test_params.buffer_size = buffer_sizes[size_idx];
+            PrintSize(buffer_sizes[size_idx]);
+            
+            for (u32 depth_idx = 0; depth_idx < ArrayCount(ring_depths); ++depth_idx)
+            {
+                test_params.ring_depth = ring_depths[depth_idx];
+                
+                char point[64];
+                snprintf(point, sizeof(point), "%lluKB/depth%u", buffer_sizes[size_idx]/1024, ring_depths[depth_idx]);
+                RunRepTestSweepPoint(&rep_tester, test_function, &test_params, point, &stats);
+                
+                median_times[fn_idx][size_idx][depth_idx] = stats.median;
+                f64 seconds = stats.median/(f64)rep_tester.cpu_freq;
+                printf(", %.3f", ((f64)test_params.file_size/(1024.0*1024.0*1024.0))/seconds);
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+    }
+    
+    if (read_only_idx < g_RepTestCount)
+    {
+        printf("\nRead time hidden by the best ring, per buffer size\nKernel");
+        for (u32 size_idx = 0; size_idx < buffer_size_count; ++size_idx)
+        {
+            printf(", ");
+            PrintSize(buffer_sizes[size_idx]);
+        }
+        printf("\n");
+        
+        for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+        {
+            if ((fn_idx == read_only_idx) || !IsRepTestSelected(&config, g_RepTests + fn_idx))
+                continue;
+            
+            printf("%s", g_RepTests[fn_idx].name);
+            for (u32 size_idx = 0; size_idx < buffer_size_count; ++size_idx)
+            {
+                f64 serial_time = median_times[fn_idx][size_idx][0];
+                f64 best_time = median_times[fn_idx][size_idx][1];
+                for (u32 depth_idx = 2; depth_idx < ArrayCount(ring_depths); ++depth_idx)
+                {
+                    if (median_times[fn_idx][size_idx][depth_idx] < best_time)
+                        best_time = median_times[fn_idx][size_idx][depth_idx];
+                }
+                
+                f64 read_time = median_times[read_only_idx][size_idx][0];
+                printf(", %+.0f%%", 100.0*(serial_time - best_time)/read_time);
+            }
+            printf("\n");
+        }
+    }
+    
+    return EndRepTester(&rep_tester);
+}
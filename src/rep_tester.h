@@ -3,19 +3,46 @@
 
 #include "porfavor_types.h"
 #include "platform_metrics.h"
+#include "platform_threads.h"
+#include "perf_counters.h"
 
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 struct TrackedData
 {
     u64 page_fault_count;
-    // NOTE(achal): We can add more things to track here..
+    // NOTE(achal): Included in page_fault_count. Always zero on Windows which doesn't tell them apart.
+    u64 major_page_fault_count;
+    
+    // NOTE(achal): Hardware counters, with --counters and only when running single threaded, see
+    // g_RepTestReadPerfCounters. All zero otherwise.
+    u64 perf_counters[PerfCounter_Count];
 };
 
 struct TimeTrackedData
 {
     u64 time;
     TrackedData data;
+    
+    // NOTE(achal): Timestamp of the BeginTime of the interval in progress, and whether its counters were
+    // read with rdpmc, so that its EndTime reads them the same way.
+    u64 interval_begin;
+    b32 interval_counters_from_rdpmc;
+    
+    // NOTE(achal): Bytes the test actually moved, for tests which don't process their buffer exactly once
+    // (several passes over it, a part of it, ...). Zero means the buffer's size.
+    u64 bytes_processed;
+    
+    // NOTE(achal): Optional, see SetRepTestChecksum.
+    b32 has_checksum;
+    u64 checksum;
 };
 
 struct Buffer
@@ -24,60 +51,678 @@ struct Buffer
     u8 *data;
 };
 
+// NOTE(achal): At most this many repetition times are kept per test. Past that the kept samples are a
+// uniform random subset of all repetitions (reservoir sampling), so percentiles of long runs of short
+// tests stay unbiased without the memory growing with the run time.
+#define REP_TESTER_MAX_SAMPLES 8192
+#define REP_TESTER_BOOTSTRAP_RESAMPLES 256
+#define REP_TESTER_MAX_THREADS 64
+#define REP_TESTER_MAX_TESTS 64
+#define REP_TESTER_MAX_RESULTS 1024
+
+struct RepTestBaselineEntry
+{
+    char name[128];
+    char alloc_mode[32];
+    u32 thread_count;
+    u32 repeat_idx;
+    f64 median;
+    f64 median_ci_low;
+    f64 median_ci_high;
+};
+
+// NOTE(achal): What a rep test program was asked to do, see ParseRepTesterCommandLine. Programs fill in
+// their own defaults (seconds, size, input) before parsing.
+struct RepTesterConfig
+{
+    f64 seconds;
+    u64 size;
+    char const *input;
+    
+    char const *filter;
+    u32 alloc_mode_mask;
+    u32 max_thread_count;
+    u32 repeat_count;
+    b32 list_only;
+    b32 checksum_outputs;
+    b32 perf_counters;
+    
+    u64 max_test_count;
+    f64 target_ci_width;
+    
+    // NOTE(achal): pin_cpu < 0 pins to whichever CPU we happen to start on.
+    b32 no_pin;
+    s32 pin_cpu;
+    b32 high_priority;
+    f64 max_warmup_seconds;
+    
+    char const *json_path;
+    char const *baseline_path;
+    f64 regression_threshold;
+};
+
+// NOTE(achal): What the tests actually ran under, see SetUpRepTestEnvironment.
+struct RepTestEnvironment
+{
+    s32 pinned_cpu; // -1 if not pinned
+    b32 is_high_priority;
+    char governor[32]; // empty if unknown
+    s32 turbo; // -1 if unknown
+    b32 is_warmup_settled;
+    f64 warmup_seconds;
+    u64 timer_overhead; // in CPU timer ticks, see MeasureTimerOverhead
+    b32 has_perf_counters;
+};
+
 struct RepTester
 {
     u64 cpu_freq;
     u64 try_for_time;
     
+    // NOTE(achal): Optional stopping rules, checked in addition to "no new minimum for try_for_time".
+    // Zero disables them. target_ci_width is the width of the 95% confidence interval of the median
+    // relative to the median, e.g. 0.01 to stop once the median is known to within 1%.
+    u64 max_test_count;
+    f64 target_ci_width;
+    
+    u64 random_state;
+    
     Buffer reuse_buffer;
+    
+    RepTesterConfig config;
+    RepTestEnvironment environment;
+    u32 repeat_idx;
+    
+    // NOTE(achal): Reporting, see BeginRepTestReport. The progress line (rewritten in place with \r) is
+    // only printed when stdout is a terminal so that redirected output stays clean.
+    b32 is_interactive;
+    FILE *json_file;
+    u32 json_result_count;
+    
+    u32 checksum_mismatch_count;
+    
+    u32 baseline_count;
+    RepTestBaselineEntry *baseline;
+    f64 regression_threshold;
+    u32 regression_count;
+};
+
+struct RepTestStats
+{
+    u64 test_count;
+    
+    // NOTE(achal): With more than one thread each sample is the slowest thread's time for that
+    // repetition, since that's when the whole buffer is done. Each thread's own best time is kept
+    // alongside.
+    u32 thread_count;
+    u64 thread_min_time[REP_TESTER_MAX_THREADS];
+    u64 thread_slice_size[REP_TESTER_MAX_THREADS];
+    
+    // NOTE(achal): As reported by the test (see TimeTrackedData), zero if it didn't.
+    u64 bytes_processed;
+    
+    // NOTE(achal): The first repetition's checksum, and how many of the later ones disagreed with it.
+    b32 has_checksum;
+    u64 checksum;
+    u64 checksum_mismatch_count;
+    
+    TimeTrackedData min;
+    TimeTrackedData max;
+    TimeTrackedData sum;
+    
+    // NOTE(achal): Welford's running mean and sum of squared deviations over all repetitions, not just
+    // the kept samples.
+    f64 mean;
+    f64 m2;
+    
+    u64 sample_count;
+    u64 samples[REP_TESTER_MAX_SAMPLES];
+    
+    // NOTE(achal): Filled in by ComputeRepTestStats, from the kept samples.
+    f64 stddev;
+    f64 median;
+    f64 p90;
+    f64 p99;
+    f64 median_ci_low;
+    f64 median_ci_high;
 };
 
 struct TestParams;
 
+typedef TimeTrackedData TestFunctionProc(TestParams *params, Buffer *buffer);
+
 struct TestFunction
 {
     char const *name;
-    TimeTrackedData (*fn)(TestParams *, Buffer *);
+    TestFunctionProc *fn;
+    
+    // NOTE(achal): Only works on the buffer it's given, so it can be run on slices of it by several threads
+    // at once, see REP_TEST_SLICED.
+    b32 is_sliced;
 };
 
+/*
+NOTE(achal):
+Tests register themselves with REP_TEST, in the order they're defined in, and REP_TEST_MAIN writes the
+main which parses the command line and runs them all:
+
+    struct TestParams { char const *path; };
+    
+    REP_TEST(fread)
+    {
+        TimeTrackedData time_data = {};
+        ... // params and buffer are the arguments
+        return time_data;
+    }
+    
+    static b32 SetUp(RepTesterConfig *config, TestParams *params, Buffer *reuse_buffer) { ... }
+    
+    REP_TEST_MAIN(10.0, 0, "data/input.json", SetUp)
+
+The setup fills in the test params and the reuse buffer from the parsed config. It isn't called with
+--list, and returning false exits with an error.
+
+With --threads N a test is run on 1..N threads at once, each on its own slice of the buffer, but only if it
+was defined with REP_TEST_SLICED instead, i.e. it touches nothing but its buffer. Tests which work on the
+whole input in the params, or on a file, or on any other shared state only ever run single threaded.
+*/
+static TestFunction g_RepTests[REP_TESTER_MAX_TESTS];
+static u32 g_RepTestCount;
+
+static b32 RegisterRepTest(char const *name, TestFunctionProc *fn, b32 is_sliced)
+{
+    assert(g_RepTestCount < REP_TESTER_MAX_TESTS);
+    g_RepTests[g_RepTestCount].name = name;
+    g_RepTests[g_RepTestCount].fn = fn;
+    g_RepTests[g_RepTestCount].is_sliced = is_sliced;
+    ++g_RepTestCount;
+    return 1;
+}
+
+// NOTE(achal): For tests which can't run with the inputs they were given, call it from the setup.
+static void UnregisterRepTest(char const *name)
+{
+    for (u32 test_idx = 0; test_idx < g_RepTestCount; ++test_idx)
+    {
+        if (strcmp(g_RepTests[test_idx].name, name) == 0)
+        {
+            memmove(g_RepTests + test_idx, g_RepTests + test_idx + 1, (g_RepTestCount - test_idx - 1)*sizeof(TestFunction));
+            --g_RepTestCount;
+            break;
+        }
+    }
+}
+
+#define REP_TEST_IMPL(name, is_sliced) \
+static TimeTrackedData RepTest_##name(TestParams *params, Buffer *buffer); \
+static b32 g_RepTestRegistered_##name = RegisterRepTest(#name, RepTest_##name, is_sliced); \
+static TimeTrackedData RepTest_##name(TestParams *params, Buffer *buffer)
+
+#define REP_TEST(name) REP_TEST_IMPL(name, 0)
+#define REP_TEST_SLICED(name) REP_TEST_IMPL(name, 1)
+
+typedef b32 RepTestSetupProc(RepTesterConfig *config, TestParams *params, Buffer *reuse_buffer);
+
+#define REP_TEST_MAIN(default_seconds, default_size, default_input, setup) \
+int main(int argc, char **argv) \
+{ \
+    static TestParams test_params; \
+    RepTesterConfig config = DefaultRepTesterConfig(default_seconds, default_size, default_input); \
+    return RepTestMain(argc, argv, &config, setup, &test_params); \
+}
+
+// NOTE(achal): Optimizer barriers. DoNotOptimize makes the compiler believe that whatever `value` points
+// at is read (so the work that produced it has to happen) and that any memory may have changed (so it
+// can't be cached in registers across the call). ClobberMemory is just the latter. Use them on results
+// nobody looks at, or the compiler is free to drop the loop which produced them, or hoist it out of the
+// timed region.
+#if defined(_WIN32) || defined( _WIN64)
+static void const volatile *g_DoNotOptimizeEscape;
+
+inline static void DoNotOptimize(void const *value)
+{
+    g_DoNotOptimizeEscape = value;
+    _ReadWriteBarrier();
+}
+
+inline static void ClobberMemory()
+{
+    _ReadWriteBarrier();
+}
+#else
+inline static void DoNotOptimize(void const *value)
+{
+    asm volatile("" : : "r"(value) : "memory");
+}
+
+inline static void ClobberMemory()
+{
+    asm volatile("" : : : "memory");
+}
+#endif
+
+// NOTE(achal): Checksums are optional. A test which sets one gets it compared across all its repetitions
+// (and summed over the slices, with threads), and any repetition which disagrees is reported: it means the
+// test didn't do the same work every time. Cheap results, like a sum, can be set always;
+// ChecksumRepTestOutput hashes a whole output buffer, so it's only done with --checksum.
+static b32 g_RepTestChecksumOutputs;
+
+inline static void SetRepTestChecksum(TimeTrackedData *time_data, u64 checksum)
+{
+    time_data->has_checksum = 1;
+    time_data->checksum = checksum;
+}
+
+// NOTE(achal): FNV-1a, a u64 at a time.
+static u64 ChecksumBytes(void const *data, u64 size)
+{
+    u8 const *bytes = (u8 const *)data;
+    u64 hash = 0xCBF29CE484222325ull;
+    
+    u64 idx = 0;
+    for (; idx+8 <= size; idx += 8)
+    {
+        u64 word;
+        memcpy(&word, bytes + idx, sizeof(word));
+        hash = (hash ^ word)*0x100000001B3ull;
+    }
+    for (; idx < size; ++idx)
+        hash = (hash ^ bytes[idx])*0x100000001B3ull;
+    
+    return hash;
+}
+
+inline static void ChecksumRepTestOutput(TimeTrackedData *time_data, void const *data, u64 size)
+{
+    if (g_RepTestChecksumOutputs)
+        SetRepTestChecksum(time_data, ChecksumBytes(data, size));
+}
+
+// NOTE(achal): How each repetition gets its buffer, see HandleAllocation. On Windows the mmap modes map to
+// VirtualAlloc; MAP_POPULATE and THP have no equivalent there and large pages need SeLockMemoryPrivilege,
+// so those get skipped when they can't be honoured.
 enum AllocationMode
 {
-    AllocationMode_None = 0,
+    AllocationMode_None = 0,        // The reuse buffer
     AllocationMode_malloc,
+    AllocationMode_mallocTouched,   // malloc, then one write per page before the test runs
+    AllocationMode_mmap,
+    AllocationMode_mmapPopulate,    // MAP_POPULATE
+    AllocationMode_mmapTHP,         // 2MB aligned and madvise(MADV_HUGEPAGE)
+    AllocationMode_mmapHugeTLB,     // MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages
+    AllocationMode_aligned4K,
+    AllocationMode_aligned2M,
     AllocationMode_Count
 };
 
-static RepTester MakeRepTester(f64 try_for_seconds, Buffer *reuse_buffer)
+static char const *g_AllocationModeNames[AllocationMode_Count] =
+{
+    "none",
+    "malloc",
+    "malloc_touched",
+    "mmap",
+    "mmap_populate",
+    "mmap_thp",
+    "mmap_hugetlb",
+    "aligned_4k",
+    "aligned_2m",
+};
+
+#define REP_TESTER_DEFAULT_ALLOC_MODES ((1u << AllocationMode_None) | (1u << AllocationMode_malloc))
+
+// NOTE(achal): The median of everything RunTest ran, in order, for programs which print a summary of their
+// own at the end.
+struct RepTestResult
+{
+    char const *name;
+    AllocationMode alloc_mode;
+    u32 thread_count;
+    u32 repeat_idx;
+    u64 bytes_processed;
+    f64 median; // in CPU timer ticks
+    f64 avg_page_fault_count;
+};
+static RepTestResult g_RepTestResults[REP_TESTER_MAX_RESULTS];
+static u32 g_RepTestResultCount;
+
+static RepTesterConfig DefaultRepTesterConfig(f64 seconds, u64 size, char const *input)
+{
+    RepTesterConfig config = {};
+    config.seconds = seconds;
+    config.size = size;
+    config.input = input;
+    config.alloc_mode_mask = REP_TESTER_DEFAULT_ALLOC_MODES;
+    config.max_thread_count = 1;
+    config.repeat_count = 1;
+    config.pin_cpu = -1;
+    config.max_warmup_seconds = 2.0;
+    config.regression_threshold = 0.02;
+    return config;
+}
+
+// NOTE(achal): Spins on a dependent multiply-add chain in fixed size blocks until the fastest block of
+// a window, in TSC ticks, has stayed within 1% of the same reference for several windows in a row.
+// The TSC runs at a fixed rate, so that only happens once the core clock has stopped ramping. Taking
+// the fastest block of each window keeps interrupts from resetting the count.
+static b32 WarmUpCPU(u64 cpu_freq, f64 max_seconds, f64 *elapsed_seconds)
+{
+    u64 max_time = (u64)(max_seconds*cpu_freq);
+    
+    volatile u64 seed = 1;
+    u64 x = seed;
+    
+    b32 result = 0;
+    u64 reference_time = 0;
+    u32 stable_window_count = 0;
+    
+    u64 begin = ReadCPUTimer();
+    u64 now = begin;
+    while (now - begin < max_time)
+    {
+        u64 window_min_time = ~0ull;
+        for (u32 block_idx = 0; block_idx < 16; ++block_idx)
+        {
+            u64 block_begin = ReadCPUTimer();
+            for (u32 i = 0; i < 250000; ++i)
+                x = x*0x5851F42D4C957F2Dull + 0x14057B7EF767814Full;
+            now = ReadCPUTimer();
+            
+            if (now - block_begin < window_min_time)
+                window_min_time = now - block_begin;
+        }
+        
+        u64 diff = (window_min_time > reference_time) ? window_min_time - reference_time : reference_time - window_min_time;
+        if (reference_time && (100*diff <= reference_time))
+        {
+            if (++stable_window_count == 4)
+            {
+                result = 1;
+                break;
+            }
+        }
+        else
+        {
+            reference_time = window_min_time;
+            stable_window_count = 0;
+        }
+    }
+    
+    seed = x;
+    *elapsed_seconds = (f64)(now - begin)/(f64)cpu_freq;
+    return result;
+}
+
+// NOTE(achal): Subtracted from every BeginTime/EndTime interval, see MeasureTimerOverhead.
+static u64 g_RepTestTimerOverhead;
+
+// NOTE(achal): The cost of an empty timed interval, i.e. of the serialized timestamps themselves, which
+// is hundreds of cycles and would otherwise dominate tests which only run for a few microseconds. The
+// minimum over many tries, since anything above that is noise rather than a fixed cost.
+static u64 MeasureTimerOverhead()
+{
+    u64 result = ~0ull;
+    for (u32 i = 0; i < 4096; ++i)
+    {
+        u64 begin = ReadCPUTimerBegin();
+        u64 end = ReadCPUTimerEnd();
+        if (end - begin < result)
+            result = end - begin;
+    }
+    return result;
+}
+
+// NOTE(achal): Migrations and frequency ramps are the biggest sources of noise we can do something
+// about, the rest (governor, turbo) we can only warn about.
+static void SetUpRepTestEnvironment(RepTester *rep_tester)
+{
+    RepTesterConfig *config = &rep_tester->config;
+    RepTestEnvironment *environment = &rep_tester->environment;
+    
+    environment->pinned_cpu = -1;
+    if (!config->no_pin)
+    {
+        u32 cpu = (config->pin_cpu < 0) ? GetOSCurrentCPU() : (u32)config->pin_cpu;
+        if (PinCurrentThreadToCPU(cpu))
+            environment->pinned_cpu = (s32)cpu;
+        else
+            fprintf(stderr, "WARNING: Failed to pin the test thread to CPU %u\n", cpu);
+    }
+    
+    if (config->high_priority)
+    {
+        environment->is_high_priority = RaiseCurrentThreadPriority();
+        if (!environment->is_high_priority)
+            fprintf(stderr, "WARNING: Failed to raise the test thread's priority (needs elevated privileges)\n");
+    }
+    
+    u32 cpu = (environment->pinned_cpu >= 0) ? (u32)environment->pinned_cpu : GetOSCurrentCPU();
+    ReadCPUFrequencyGovernor(cpu, environment->governor, sizeof(environment->governor));
+    if (environment->governor[0] && (strcmp(environment->governor, "performance") != 0))
+        fprintf(stderr, "WARNING: cpufreq governor is \"%s\", the clock will ramp up and down between and during tests\n", environment->governor);
+    
+    environment->turbo = ReadCPUTurboState();
+    if (environment->turbo == 1)
+        fprintf(stderr, "WARNING: Turbo is enabled, the clock depends on temperature and on the load on other cores\n");
+    
+    if (config->max_warmup_seconds > 0.0)
+    {
+        environment->is_warmup_settled = WarmUpCPU(rep_tester->cpu_freq, config->max_warmup_seconds, &environment->warmup_seconds);
+        if (!environment->is_warmup_settled)
+            fprintf(stderr, "WARNING: The clock did not settle within %.1f s of warmup\n", config->max_warmup_seconds);
+    }
+    
+    if (config->perf_counters)
+    {
+        environment->has_perf_counters = InitializePerfCounters();
+        if (!environment->has_perf_counters)
+            fprintf(stderr, "WARNING: Hardware performance counters are unavailable (no PMU, or perf_event_paranoid too strict)\n");
+    }
+    
+    // NOTE(achal): After the warmup, so that it's measured at the clock the tests will run at.
+    environment->timer_overhead = MeasureTimerOverhead();
+    g_RepTestTimerOverhead = environment->timer_overhead;
+    
+    // NOTE(achal): To stderr like the warnings above, stdout is the results (CSV for the sweeps).
+    fprintf(stderr, "Environment: ");
+    if (environment->pinned_cpu >= 0)
+        fprintf(stderr, "pinned to CPU %d", environment->pinned_cpu);
+    else
+        fprintf(stderr, "not pinned");
+    fprintf(stderr, ", %s priority", environment->is_high_priority ? "high" : "normal");
+    fprintf(stderr, ", governor: %s", environment->governor[0] ? environment->governor : "unknown");
+    fprintf(stderr, ", turbo: %s", (environment->turbo == -1) ? "unknown" : (environment->turbo ? "on" : "off"));
+    if (config->max_warmup_seconds > 0.0)
+        fprintf(stderr, ", warmup: %s after %.1f ms", environment->is_warmup_settled ? "settled" : "gave up", environment->warmup_seconds*1000.0);
+    fprintf(stderr, ", timer overhead: %llu ticks", environment->timer_overhead);
+    if (config->perf_counters)
+        fprintf(stderr, ", counters: %s", environment->has_perf_counters ? "on" : "unavailable");
+    fprintf(stderr, "\n");
+}
+
+static RepTester MakeRepTester(RepTesterConfig *config, Buffer *reuse_buffer)
 {
-    Win32_InitializePlatformMetrics();
+    InitializePlatformMetrics();
     
     RepTester rep_tester = {};
-    rep_tester.cpu_freq = EstimateCPUTimerFrequency(100);
-    rep_tester.try_for_time = (u64)(try_for_seconds*rep_tester.cpu_freq);
+    rep_tester.config = *config;
+    rep_tester.cpu_freq = GetCPUTimerFrequency();
+    rep_tester.try_for_time = (u64)(config->seconds*rep_tester.cpu_freq);
+    rep_tester.max_test_count = config->max_test_count;
+    rep_tester.target_ci_width = config->target_ci_width;
+    rep_tester.random_state = 0x9E3779B97F4A7C15ull;
+    rep_tester.is_interactive = IsStdoutInteractive();
+    rep_tester.regression_threshold = config->regression_threshold;
     rep_tester.reuse_buffer = *reuse_buffer;
+    g_RepTestChecksumOutputs = config->checksum_outputs;
+    
+    if (!config->list_only)
+        SetUpRepTestEnvironment(&rep_tester);
     
     return rep_tester;
 }
 
+#define HUGE_PAGE_SIZE (2ull*1024*1024)
+
+inline static u64 AlignUp(u64 value, u64 alignment)
+{
+    u64 result = (value + alignment - 1) & ~(alignment - 1);
+    return result;
+}
+
+// NOTE(achal): Returns a buffer with null data if the mode isn't available on this machine.
 inline static Buffer HandleAllocation(AllocationMode alloc_mode, Buffer *src_buffer)
 {
     Buffer result = {};
     result.size = src_buffer->size;
     result.data = src_buffer->data;
     
-    if (alloc_mode == AllocationMode_malloc)
-        result.data = (u8 *)malloc(result.size);
+    u64 size = result.size;
+    switch (alloc_mode)
+    {
+        case AllocationMode_None: break;
+        
+        case AllocationMode_malloc:
+        {
+            result.data = (u8 *)malloc(size);
+        } break;
+        
+        case AllocationMode_mallocTouched:
+        {
+            result.data = (u8 *)malloc(size);
+            if (result.data)
+            {
+                u64 page_size = GetOSPageSize();
+                for (u64 offset = 0; offset < size; offset += page_size)
+                    result.data[offset] = 0;
+            }
+        } break;
+        
+#ifdef _WIN32
+        case AllocationMode_mmap:
+        {
+            result.data = (u8 *)VirtualAlloc(0, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        } break;
+        
+        case AllocationMode_mmapHugeTLB:
+        {
+            u64 large_page_size = GetLargePageMinimum();
+            result.data = large_page_size ? (u8 *)VirtualAlloc(0, AlignUp(size, large_page_size), MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE) : 0;
+        } break;
+        
+        case AllocationMode_aligned4K:
+        {
+            result.data = (u8 *)_aligned_malloc(size, 4096);
+        } break;
+        
+        case AllocationMode_aligned2M:
+        {
+            result.data = (u8 *)_aligned_malloc(size, HUGE_PAGE_SIZE);
+        } break;
+        
+        default:
+        {
+            result.data = 0;
+        } break;
+#else
+        case AllocationMode_mmap:
+        case AllocationMode_mmapPopulate:
+        {
+            int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+            if (alloc_mode == AllocationMode_mmapPopulate)
+                flags |= MAP_POPULATE;
+            
+            void *data = mmap(0, size, PROT_READ|PROT_WRITE, flags, -1, 0);
+            result.data = (data == MAP_FAILED) ? 0 : (u8 *)data;
+        } break;
+        
+        case AllocationMode_mmapTHP:
+        {
+            // NOTE(achal): Over-allocate by a huge page and unmap the slack on either side, so that what's
+            // left is exactly [data, data+size) and 2MB aligned.
+            u64 mapped_size = size + HUGE_PAGE_SIZE;
+            void *mapping = mmap(0, mapped_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED)
+            {
+                result.data = 0;
+                break;
+            }
+            
+            u8 *begin = (u8 *)mapping;
+            u8 *aligned = (u8 *)AlignUp((u64)begin, HUGE_PAGE_SIZE);
+            u8 *end = begin + mapped_size;
+            u8 *aligned_end = aligned + AlignUp(size, GetOSPageSize());
+            if (aligned > begin)
+                munmap(begin, aligned - begin);
+            if (end > aligned_end)
+                munmap(aligned_end, end - aligned_end);
+            
+            madvise(aligned, size, MADV_HUGEPAGE);
+            result.data = aligned;
+        } break;
+        
+        case AllocationMode_mmapHugeTLB:
+        {
+            void *data = mmap(0, AlignUp(size, HUGE_PAGE_SIZE), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+            result.data = (data == MAP_FAILED) ? 0 : (u8 *)data;
+        } break;
+        
+        case AllocationMode_aligned4K:
+        {
+            result.data = (u8 *)aligned_alloc(4096, AlignUp(size, 4096));
+        } break;
+        
+        case AllocationMode_aligned2M:
+        {
+            result.data = (u8 *)aligned_alloc(HUGE_PAGE_SIZE, AlignUp(size, HUGE_PAGE_SIZE));
+        } break;
+        
+        default: assert(0);
+#endif
+    }
     
     return result;
 }
 
 inline static void HandleDeallocation(AllocationMode alloc_mode, Buffer *buffer)
 {
-    if (alloc_mode == AllocationMode_malloc)
+    if ((alloc_mode == AllocationMode_None) || !buffer->data)
+        return;
+    
+    switch (alloc_mode)
     {
-        free(buffer->data);
-        buffer->data = 0;
+#ifdef _WIN32
+        case AllocationMode_mmap:
+        case AllocationMode_mmapHugeTLB:
+        {
+            VirtualFree(buffer->data, 0, MEM_RELEASE);
+        } break;
+        
+        case AllocationMode_aligned4K:
+        case AllocationMode_aligned2M:
+        {
+            _aligned_free(buffer->data);
+        } break;
+#else
+        case AllocationMode_mmap:
+        case AllocationMode_mmapPopulate:
+        case AllocationMode_mmapTHP:
+        {
+            munmap(buffer->data, buffer->size);
+        } break;
+        
+        case AllocationMode_mmapHugeTLB:
+        {
+            munmap(buffer->data, AlignUp(buffer->size, HUGE_PAGE_SIZE));
+        } break;
+#endif
+        
+        default:
+        {
+            free(buffer->data);
+        } break;
     }
+    
+    buffer->data = 0;
 }
 
 inline static void PrintTime(char const *label, f64 time, u64 freq, u64 bytes_processed)
@@ -90,110 +735,1297 @@ inline static void PrintTime(char const *label, f64 time, u64 freq, u64 bytes_pr
     printf("%s: %.0f (%.3f ms) at %.3f GB/s", label, time, ms, gigabytes_per_second);
 }
 
-inline static void PrintPageFaults(f64 page_fault_count, u64 bytes_processed)
+inline static void PrintPageFaults(f64 page_fault_count, f64 major_page_fault_count, u64 bytes_processed)
 {
     f64 kb_per_fault = (f64)bytes_processed/(page_fault_count*1024.0);
     printf(", PF: %.4f (%.4f KBs/PageFault)", page_fault_count, kb_per_fault);
+    if (major_page_fault_count > 0.0)
+        printf(", Major PF: %.4f", major_page_fault_count);
+}
+
+// NOTE(achal): Counts are per repetition (of the one repetition for min and max, averaged for avg) and
+// per byte processed.
+inline static void PrintPerfCounters(f64 const *perf_counters, u64 bytes_processed)
+{
+    f64 cycles = perf_counters[PerfCounter_Cycles];
+    printf(", IPC: %.3f", perf_counters[PerfCounter_Instructions]/cycles);
+    printf(", %s: %.0f (%.4f/byte)", g_PerfCounterNames[PerfCounter_Cycles], cycles, cycles/(f64)bytes_processed);
+    
+    for (u32 i = PerfCounter_L1DMisses; i < PerfCounter_Count; ++i)
+    {
+        if (IsPerfCounterAvailable(i))
+            printf(", %s: %.0f (%.4f/byte)", g_PerfCounterNames[i], perf_counters[i], perf_counters[i]/(f64)bytes_processed);
+    }
 }
 
-inline static void PrintTimeWithPageFaults(char const *label, f64 time, f64 page_fault_count, u64 cpu_freq, u64 bytes_processed)
+// NOTE(achal): perf_counters can be null, and are only printed if the cycle counter ran.
+inline static void PrintTimeWithPageFaults(char const *label, f64 time, f64 page_fault_count, f64 major_page_fault_count, f64 const *perf_counters, u64 cpu_freq, u64 bytes_processed)
 {
     PrintTime(label, time, cpu_freq, bytes_processed);
     if (page_fault_count > 0.0)
-        PrintPageFaults(page_fault_count, bytes_processed);
+        PrintPageFaults(page_fault_count, major_page_fault_count, bytes_processed);
+    if (perf_counters && (perf_counters[PerfCounter_Cycles] > 0.0))
+        PrintPerfCounters(perf_counters, bytes_processed);
 }
 
+// NOTE(achal): Set per test run by RunTestWithAllocationMode. The counters belong to the main thread (and
+// are read with rdpmc, which on any other thread reads some other thread's counters), so they're only
+// read when the test runs on the main thread alone.
+static b32 g_RepTestReadPerfCounters;
+
+// NOTE(achal): The page fault counts are read outside of the timed interval, they're a syscall (or two on
+// Windows) each. The interval is measured with serialized timestamps, minus what an empty one costs.
 inline static void BeginTime(TimeTrackedData *time_data)
 {
-    time_data->data.page_fault_count -= ReadOSPageFaultCount();
+    u64 minor, major;
+    ReadOSPageFaultCounts(&minor, &major);
+    time_data->data.page_fault_count -= minor + major;
+    time_data->data.major_page_fault_count -= major;
+    
+    if (g_RepTestReadPerfCounters)
+    {
+        PerfCounterValues counters;
+        ReadPerfCounters(&counters, 1);
+        time_data->interval_counters_from_rdpmc = counters.is_from_rdpmc;
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            time_data->data.perf_counters[i] -= counters.values[i];
+    }
     
-    time_data->time -= ReadCPUTimer();
+    ClobberMemory();
+    time_data->interval_begin = ReadCPUTimerBegin();
+    ClobberMemory();
 }
 
 inline static void EndTime(TimeTrackedData *time_data)
 {
-    time_data->time += ReadCPUTimer();
+    ClobberMemory();
+    u64 interval_end = ReadCPUTimerEnd();
+    ClobberMemory();
+    
+    u64 elapsed = interval_end - time_data->interval_begin;
+    time_data->time += (elapsed > g_RepTestTimerOverhead) ? elapsed - g_RepTestTimerOverhead : 0;
+    
+    if (g_RepTestReadPerfCounters)
+    {
+        PerfCounterValues counters;
+        ReadPerfCounters(&counters, time_data->interval_counters_from_rdpmc);
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            time_data->data.perf_counters[i] += counters.values[i];
+    }
+    
+    u64 minor, major;
+    ReadOSPageFaultCounts(&minor, &major);
+    time_data->data.page_fault_count += minor + major;
+    time_data->data.major_page_fault_count += major;
+}
+
+static u64 RepTesterRandom(RepTester *rep_tester)
+{
+    u64 x = rep_tester->random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    rep_tester->random_state = x;
+    return x;
+}
+
+static int CompareU64(void const *a, void const *b)
+{
+    u64 x = *(u64 const *)a;
+    u64 y = *(u64 const *)b;
+    return (x > y) - (x < y);
+}
+
+static int CompareF64(void const *a, void const *b)
+{
+    f64 x = *(f64 const *)a;
+    f64 y = *(f64 const *)b;
+    return (x > y) - (x < y);
+}
+
+// NOTE(achal): Linear interpolation between the two closest ranks.
+static f64 GetSortedPercentile(u64 *sorted, u64 count, f64 percentile)
+{
+    f64 rank = percentile*(f64)(count-1);
+    u64 lo = (u64)rank;
+    u64 hi = (lo+1 < count) ? lo+1 : lo;
+    f64 t = rank - (f64)lo;
     
-    time_data->data.page_fault_count += ReadOSPageFaultCount();
+    f64 result = (1.0-t)*(f64)sorted[lo] + t*(f64)sorted[hi];
+    return result;
 }
 
-static void RunTest(RepTester *rep_tester, TestFunction *test_function, TestParams *test_params)
+// NOTE(achal): Quickselect, partially reorders values so that values[k] is the k-th smallest.
+static u64 SelectKthSmallest(u64 *values, u64 count, u64 k)
 {
-    for (u32 alloc_mode = 0; alloc_mode < AllocationMode_Count; ++alloc_mode)
+    s64 lo = 0;
+    s64 hi = (s64)count-1;
+    while (lo < hi)
     {
-        printf("\n--------%s", test_function->name);
-        if (alloc_mode == AllocationMode_malloc)
-            printf(" + malloc");
-        printf("--------\n");
-        
-        TimeTrackedData min_time_data = {};
-        min_time_data.time = ~0ull;
-        
-        TimeTrackedData max_time_data = {};
-        TimeTrackedData avg_time_data = {};
-        
-        u32 test_count = 0;
-        u64 tester_start_time = ReadCPUTimer();
-        u64 tester_elapsed = ReadCPUTimer()-tester_start_time;
-        
-        while (tester_elapsed < rep_tester->try_for_time)
+        u64 pivot = values[lo + (hi-lo)/2];
+        s64 i = lo;
+        s64 j = hi;
+        while (i <= j)
         {
-            ++test_count;
-            
-            Buffer buffer = HandleAllocation((AllocationMode)alloc_mode, &rep_tester->reuse_buffer);
-            TimeTrackedData time_data = test_function->fn(test_params, &buffer);
-            HandleDeallocation((AllocationMode)alloc_mode, &buffer);
-            
-            if (time_data.time < min_time_data.time)
-            {
-                min_time_data = time_data;
-                
-                f64 time = (f64)min_time_data.time;
-                f64 pf_count = (f64)min_time_data.data.page_fault_count;
-                printf("                                                                                        \r");
-                PrintTimeWithPageFaults("Min Time", time, pf_count, rep_tester->cpu_freq, buffer.size);
-                printf("\r");
-                
-                tester_start_time = ReadCPUTimer();
-            }
+            while (values[i] < pivot)
+                ++i;
+            while (values[j] > pivot)
+                --j;
             
-            if (time_data.time > max_time_data.time)
+            if (i <= j)
             {
-                max_time_data = time_data;
+                u64 temp = values[i];
+                values[i] = values[j];
+                values[j] = temp;
+                ++i;
+                --j;
             }
-            
-            avg_time_data.time += time_data.time;
-            avg_time_data.data.page_fault_count += time_data.data.page_fault_count;
-            
-            tester_elapsed = ReadCPUTimer()-tester_start_time;
-        }
-        
-        u64 bytes_processed = rep_tester->reuse_buffer.size;
-        
-        // Min
-        {
-            f64 time = (f64)min_time_data.time;
-            f64 pf_count = (f64)min_time_data.data.page_fault_count;
-            PrintTimeWithPageFaults("Min Time", time, pf_count, rep_tester->cpu_freq, bytes_processed);
-            printf("\n");
         }
         
-        // Max
+        if ((s64)k <= j)
+            hi = j;
+        else if ((s64)k >= i)
+            lo = i;
+        else
+            break;
+    }
+    
+    return values[k];
+}
+
+static void AddRepTestSample(RepTester *rep_tester, RepTestStats *stats, TimeTrackedData *time_data)
+{
+    ++stats->test_count;
+    
+    if (time_data->has_checksum)
+    {
+        if (!stats->has_checksum)
         {
-            f64 time = (f64)max_time_data.time;
-            f64 pf_count = (f64)max_time_data.data.page_fault_count;
-            PrintTimeWithPageFaults("Max Time", time, pf_count, rep_tester->cpu_freq, bytes_processed);
-            printf("\n");
+            stats->has_checksum = 1;
+            stats->checksum = time_data->checksum;
         }
-        
-        // Avg
+        else if (time_data->checksum != stats->checksum)
         {
-            f64 time = (f64)avg_time_data.time/(f64)test_count;
-            f64 pf_count = (f64)avg_time_data.data.page_fault_count/(f64)test_count;
-            PrintTimeWithPageFaults("Avg Time", time, pf_count, rep_tester->cpu_freq, bytes_processed);
-            printf("\n");
+            ++stats->checksum_mismatch_count;
         }
     }
+    
+    if (time_data->time < stats->min.time)
+        stats->min = *time_data;
+    
+    if (time_data->time > stats->max.time)
+        stats->max = *time_data;
+    
+    stats->sum.time += time_data->time;
+    stats->sum.data.page_fault_count += time_data->data.page_fault_count;
+    stats->sum.data.major_page_fault_count += time_data->data.major_page_fault_count;
+    for (u32 i = 0; i < PerfCounter_Count; ++i)
+        stats->sum.data.perf_counters[i] += time_data->data.perf_counters[i];
+    
+    f64 x = (f64)time_data->time;
+    f64 delta = x - stats->mean;
+    stats->mean += delta/(f64)stats->test_count;
+    stats->m2 += delta*(x - stats->mean);
+    
+    if (stats->sample_count < REP_TESTER_MAX_SAMPLES)
+    {
+        stats->samples[stats->sample_count++] = time_data->time;
+    }
+    else
+    {
+        u64 idx = RepTesterRandom(rep_tester) % stats->test_count;
+        if (idx < REP_TESTER_MAX_SAMPLES)
+            stats->samples[idx] = time_data->time;
+    }
+}
+
+// NOTE(achal): Percentile bootstrap: the median of many resamples (with replacement) of the kept
+// samples, of which the 2.5th and 97.5th percentiles bound the 95% confidence interval. Makes no
+// assumption about the shape of the distribution, which for timings is anything but normal.
+static void ComputeMedianConfidenceInterval(RepTester *rep_tester, RepTestStats *stats, f64 *low, f64 *high)
+{
+    u64 count = stats->sample_count;
+    u64 *resample = (u64 *)malloc(count*sizeof(u64));
+    f64 medians[REP_TESTER_BOOTSTRAP_RESAMPLES];
+    
+    for (u32 resample_idx = 0; resample_idx < REP_TESTER_BOOTSTRAP_RESAMPLES; ++resample_idx)
+    {
+        for (u64 i = 0; i < count; ++i)
+            resample[i] = stats->samples[RepTesterRandom(rep_tester) % count];
+        
+        medians[resample_idx] = (f64)SelectKthSmallest(resample, count, count/2);
+    }
+    
+    free(resample);
+    
+    qsort(medians, REP_TESTER_BOOTSTRAP_RESAMPLES, sizeof(f64), CompareF64);
+    *low = medians[(u32)(0.025*REP_TESTER_BOOTSTRAP_RESAMPLES)];
+    *high = medians[(u32)(0.975*REP_TESTER_BOOTSTRAP_RESAMPLES)];
+}
+
+static void ComputeRepTestStats(RepTester *rep_tester, RepTestStats *stats)
+{
+    if (!stats->sample_count)
+        return;
+    
+    stats->stddev = (stats->test_count > 1) ? sqrt(stats->m2/(f64)(stats->test_count-1)) : 0.0;
+    
+    qsort(stats->samples, stats->sample_count, sizeof(u64), CompareU64);
+    stats->median = GetSortedPercentile(stats->samples, stats->sample_count, 0.5);
+    stats->p90 = GetSortedPercentile(stats->samples, stats->sample_count, 0.9);
+    stats->p99 = GetSortedPercentile(stats->samples, stats->sample_count, 0.99);
+    
+    ComputeMedianConfidenceInterval(rep_tester, stats, &stats->median_ci_low, &stats->median_ci_high);
+}
+
+// NOTE(achal): Bootstrapping is not free, so the CI rule is only evaluated every so often.
+static b32 IsMedianPreciseEnough(RepTester *rep_tester, RepTestStats *stats)
+{
+    if ((rep_tester->target_ci_width <= 0.0) || (stats->test_count < 32))
+        return 0;
+    
+    u64 n = stats->test_count;
+    b32 should_check = ((n & (n-1)) == 0) || ((n % 256) == 0);
+    if (!should_check)
+        return 0;
+    
+    f64 low, high;
+    ComputeMedianConfidenceInterval(rep_tester, stats, &low, &high);
+    f64 median = (low + high)*0.5;
+    
+    b32 result = (median > 0.0) && (((high - low)/median) <= rep_tester->target_ci_width);
+    return result;
+}
+
+static void PrintRepTestStats(RepTester *rep_tester, RepTestStats *stats, u64 bytes_processed)
+{
+    u64 test_count = stats->test_count;
+    
+    // Min
+    {
+        f64 time = (f64)stats->min.time;
+        f64 pf_count = (f64)stats->min.data.page_fault_count;
+        f64 major_pf_count = (f64)stats->min.data.major_page_fault_count;
+        f64 perf_counters[PerfCounter_Count];
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            perf_counters[i] = (f64)stats->min.data.perf_counters[i];
+        PrintTimeWithPageFaults("Min Time", time, pf_count, major_pf_count, perf_counters, rep_tester->cpu_freq, bytes_processed);
+        printf("\n");
+    }
+    
+    // Max
+    {
+        f64 time = (f64)stats->max.time;
+        f64 pf_count = (f64)stats->max.data.page_fault_count;
+        f64 major_pf_count = (f64)stats->max.data.major_page_fault_count;
+        f64 perf_counters[PerfCounter_Count];
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            perf_counters[i] = (f64)stats->max.data.perf_counters[i];
+        PrintTimeWithPageFaults("Max Time", time, pf_count, major_pf_count, perf_counters, rep_tester->cpu_freq, bytes_processed);
+        printf("\n");
+    }
+    
+    // Avg
+    {
+        f64 time = (f64)stats->sum.time/(f64)test_count;
+        f64 pf_count = (f64)stats->sum.data.page_fault_count/(f64)test_count;
+        f64 major_pf_count = (f64)stats->sum.data.major_page_fault_count/(f64)test_count;
+        f64 perf_counters[PerfCounter_Count];
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            perf_counters[i] = (f64)stats->sum.data.perf_counters[i]/(f64)test_count;
+        PrintTimeWithPageFaults("Avg Time", time, pf_count, major_pf_count, perf_counters, rep_tester->cpu_freq, bytes_processed);
+        printf("\n");
+    }
+    
+    // Median
+    {
+        PrintTime("Median", stats->median, rep_tester->cpu_freq, bytes_processed);
+        f64 ci_width = (stats->median > 0.0) ? 100.0*(stats->median_ci_high - stats->median_ci_low)/stats->median : 0.0;
+        printf(", 95%% CI: [%.0f, %.0f] (%.2f%%)\n", stats->median_ci_low, stats->median_ci_high, ci_width);
+    }
+    
+    PrintTime("P90", stats->p90, rep_tester->cpu_freq, bytes_processed);
+    printf("\n");
+    PrintTime("P99", stats->p99, rep_tester->cpu_freq, bytes_processed);
+    printf("\n");
+    
+    // Std Dev
+    {
+        f64 ms = 1000.0*stats->stddev/(f64)rep_tester->cpu_freq;
+        f64 relative = (stats->mean > 0.0) ? 100.0*stats->stddev/stats->mean : 0.0;
+        printf("Std Dev: %.0f (%.3f ms, %.2f%% of mean), %llu tests, %llu kept\n", stats->stddev, ms, relative, test_count, stats->sample_count);
+    }
+    
+    if (stats->thread_count > 1)
+    {
+        printf("Per-thread best:");
+        for (u32 thread_idx = 0; thread_idx < stats->thread_count; ++thread_idx)
+        {
+            f64 seconds = (f64)stats->thread_min_time[thread_idx]/(f64)rep_tester->cpu_freq;
+            f64 gigabytes = (f64)stats->thread_slice_size[thread_idx]/(1024.0*1024.0*1024.0);
+            printf(" %.3f", gigabytes/seconds);
+        }
+        printf(" GB/s\n");
+    }
+    
+    if (stats->has_checksum)
+    {
+        printf("Checksum: %016llx", stats->checksum);
+        if (stats->checksum_mismatch_count)
+            printf(", MISMATCHED in %llu of %llu tests", stats->checksum_mismatch_count, test_count);
+        printf("\n");
+    }
+}
+
+// NOTE(achal): Worker threads for multithreaded runs. They live for as long as one RunTestWithAllocationMode
+// call and spin waiting for the next repetition in between, so starting one costs a cache line ping
+// rather than a thread creation. The main thread takes part as thread 0.
+struct RepTestThreadPool
+{
+    u32 worker_count;
+    OSThread workers[REP_TESTER_MAX_THREADS];
+    
+    u32 volatile generation;
+    u32 volatile arrived_count;
+    u32 volatile finished_count;
+    u32 volatile should_quit;
+    
+    u32 thread_count;
+    TestFunction *test_function;
+    TestParams *test_params;
+    Buffer slices[REP_TESTER_MAX_THREADS];
+    TimeTrackedData results[REP_TESTER_MAX_THREADS];
+};
+
+struct RepTestWorker
+{
+    RepTestThreadPool *pool;
+    u32 thread_idx;
+    s32 cpu;
+};
+
+// NOTE(achal): Everyone waits at the barrier so that all slices start at (nearly) the same time,
+// otherwise the first threads would get the memory bus to themselves for a while.
+static void RunRepTestSlice(RepTestThreadPool *pool, u32 thread_idx)
+{
+    AtomicIncrementU32(&pool->arrived_count);
+    u32 spin_count = 0;
+    while (AtomicLoadU32(&pool->arrived_count) < pool->thread_count)
+        SpinWait(&spin_count);
+    
+    pool->results[thread_idx] = pool->test_function->fn(pool->test_params, pool->slices + thread_idx);
+    
+    AtomicIncrementU32(&pool->finished_count);
+}
+
+static OS_THREAD_PROC(RepTestWorkerProc)
+{
+    RepTestWorker *worker = (RepTestWorker *)param;
+    RepTestThreadPool *pool = worker->pool;
+    
+    if (worker->cpu >= 0)
+        PinCurrentThreadToCPU((u32)worker->cpu);
+    
+    u32 seen_generation = 0;
+    for (;;)
+    {
+        u32 spin_count = 0;
+        u32 generation;
+        while ((generation = AtomicLoadU32(&pool->generation)) == seen_generation)
+            SpinWait(&spin_count);
+        seen_generation = generation;
+        
+        if (AtomicLoadU32(&pool->should_quit))
+            break;
+        
+        RunRepTestSlice(pool, worker->thread_idx);
+    }
+    
+    return 0;
+}
+
+static void StartRepTestThreadPool(RepTester *rep_tester, RepTestThreadPool *pool, RepTestWorker *workers, u32 thread_count, TestFunction *test_function, TestParams *test_params)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->thread_count = thread_count;
+    pool->test_function = test_function;
+    pool->test_params = test_params;
+    pool->worker_count = thread_count-1;
+    
+    // NOTE(achal): Workers inherit the main thread's affinity, so if it was pinned they have to be pinned
+    // to cores of their own or they'd all share one.
+    s32 base_cpu = rep_tester->environment.pinned_cpu;
+    u32 cpu_count = GetOSLogicalProcessorCount();
+    
+    for (u32 worker_idx = 0; worker_idx < pool->worker_count; ++worker_idx)
+    {
+        RepTestWorker *worker = workers + worker_idx;
+        worker->pool = pool;
+        worker->thread_idx = worker_idx+1;
+        worker->cpu = (base_cpu >= 0) ? (s32)(((u32)base_cpu + worker_idx + 1) % cpu_count) : -1;
+        pool->workers[worker_idx] = CreateOSThread(RepTestWorkerProc, worker);
+    }
+}
+
+static void StopRepTestThreadPool(RepTestThreadPool *pool)
+{
+    AtomicStoreU32(&pool->should_quit, 1);
+    AtomicIncrementU32(&pool->generation);
+    
+    for (u32 worker_idx = 0; worker_idx < pool->worker_count; ++worker_idx)
+        JoinOSThread(pool->workers[worker_idx]);
+}
+
+// NOTE(achal): Slices are page aligned so that no two threads fault in the same page. Page fault counts
+// are process wide, i.e. every thread sees the faults of all the others during its interval, so the
+// repetition gets the largest count any thread saw rather than the sum.
+static TimeTrackedData RunRepTestThreaded(RepTestThreadPool *pool, Buffer *buffer)
+{
+    u32 thread_count = pool->thread_count;
+    u64 slice_size = AlignUp(buffer->size/thread_count, 4096);
+    for (u32 thread_idx = 0; thread_idx < thread_count; ++thread_idx)
+    {
+        u64 offset = (u64)thread_idx*slice_size;
+        if (offset > buffer->size)
+            offset = buffer->size;
+        
+        Buffer *slice = pool->slices + thread_idx;
+        slice->data = buffer->data + offset;
+        slice->size = (thread_idx == thread_count-1) ? buffer->size - offset : slice_size;
+        if (offset + slice->size > buffer->size)
+            slice->size = buffer->size - offset;
+    }
+    
+    AtomicStoreU32(&pool->arrived_count, 0);
+    AtomicStoreU32(&pool->finished_count, 0);
+    AtomicIncrementU32(&pool->generation);
+    
+    RunRepTestSlice(pool, 0);
+    
+    u32 spin_count = 0;
+    while (AtomicLoadU32(&pool->finished_count) < thread_count)
+        SpinWait(&spin_count);
+    
+    TimeTrackedData result = {};
+    for (u32 thread_idx = 0; thread_idx < thread_count; ++thread_idx)
+    {
+        TimeTrackedData *thread_result = pool->results + thread_idx;
+        if (thread_result->time > result.time)
+            result.time = thread_result->time;
+        result.bytes_processed += thread_result->bytes_processed;
+        result.has_checksum |= thread_result->has_checksum;
+        result.checksum += thread_result->checksum;
+        if (thread_result->data.page_fault_count > result.data.page_fault_count)
+            result.data.page_fault_count = thread_result->data.page_fault_count;
+        if (thread_result->data.major_page_fault_count > result.data.major_page_fault_count)
+            result.data.major_page_fault_count = thread_result->data.major_page_fault_count;
+    }
+    
+    return result;
+}
+
+// NOTE(achal): Returns false, without running anything, if alloc_mode isn't supported here.
+static b32 RunTestWithAllocationMode(RepTester *rep_tester, TestFunction *test_function, TestParams *test_params, AllocationMode alloc_mode, u32 thread_count, RepTestStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min.time = ~0ull;
+    stats->thread_count = thread_count;
+    for (u32 thread_idx = 0; thread_idx < thread_count; ++thread_idx)
+        stats->thread_min_time[thread_idx] = ~0ull;
+    
+    g_RepTestReadPerfCounters = rep_tester->environment.has_perf_counters && (thread_count == 1);
+    
+    // NOTE(achal): Too big for the stack.
+    static RepTestThreadPool pool;
+    static RepTestWorker workers[REP_TESTER_MAX_THREADS];
+    if (thread_count > 1)
+        StartRepTestThreadPool(rep_tester, &pool, workers, thread_count, test_function, test_params);
+    
+    b32 result = 1;
+    u64 tester_start_time = ReadCPUTimer();
+    u64 tester_elapsed = ReadCPUTimer()-tester_start_time;
+    
+    while (tester_elapsed < rep_tester->try_for_time)
+    {
+        Buffer buffer = HandleAllocation(alloc_mode, &rep_tester->reuse_buffer);
+        if (!buffer.data)
+        {
+            result = 0;
+            break;
+        }
+        
+        TimeTrackedData time_data;
+        if (thread_count > 1)
+        {
+            time_data = RunRepTestThreaded(&pool, &buffer);
+            for (u32 thread_idx = 0; thread_idx < thread_count; ++thread_idx)
+            {
+                stats->thread_slice_size[thread_idx] = pool.slices[thread_idx].size;
+                if (pool.results[thread_idx].time < stats->thread_min_time[thread_idx])
+                    stats->thread_min_time[thread_idx] = pool.results[thread_idx].time;
+            }
+        }
+        else
+        {
+            time_data = test_function->fn(test_params, &buffer);
+        }
+        HandleDeallocation(alloc_mode, &buffer);
+        
+        stats->bytes_processed = time_data.bytes_processed;
+        
+        u64 prev_min_time = stats->min.time;
+        AddRepTestSample(rep_tester, stats, &time_data);
+        
+        if (stats->min.time < prev_min_time)
+        {
+            f64 time = (f64)stats->min.time;
+            f64 pf_count = (f64)stats->min.data.page_fault_count;
+            f64 major_pf_count = (f64)stats->min.data.major_page_fault_count;
+            if (rep_tester->is_interactive)
+            {
+                printf("                                                                                        \r");
+                PrintTimeWithPageFaults("Min Time", time, pf_count, major_pf_count, 0, rep_tester->cpu_freq, buffer.size);
+                printf("\r");
+                fflush(stdout);
+            }
+            
+            tester_start_time = ReadCPUTimer();
+        }
+        
+        if (rep_tester->max_test_count && (stats->test_count >= rep_tester->max_test_count))
+            break;
+        
+        if (IsMedianPreciseEnough(rep_tester, stats))
+            break;
+        
+        tester_elapsed = ReadCPUTimer()-tester_start_time;
+    }
+    
+    if (thread_count > 1)
+        StopRepTestThreadPool(&pool);
+    
+    if (result)
+        ComputeRepTestStats(rep_tester, stats);
+    
+    return result;
+}
+
+static void WriteJSONString(FILE *file, char const *string)
+{
+    fputc('"', file);
+    for (char const *c = string; *c; ++c)
+    {
+        if ((*c == '"') || (*c == '\\'))
+            fputc('\\', file);
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+// NOTE(achal): All times are written in seconds so that a baseline from one machine (or TSC rate)
+// can be compared against another.
+static void WriteRepTestStatsJSON(RepTester *rep_tester, char const *name, AllocationMode alloc_mode, RepTestStats *stats, u64 bytes_processed)
+{
+    FILE *file = rep_tester->json_file;
+    f64 freq = (f64)rep_tester->cpu_freq;
+    f64 test_count = (f64)stats->test_count;
+    
+    if (rep_tester->json_result_count++)
+        fprintf(file, ",\n");
+    
+    fprintf(file, "{\"name\": ");
+    WriteJSONString(file, name);
+    fprintf(file, ", \"alloc_mode\": \"%s\", \"threads\": %u, \"repeat\": %u, \"bytes\": %llu, \"test_count\": %llu, \"kept_samples\": %llu", g_AllocationModeNames[alloc_mode], stats->thread_count, rep_tester->repeat_idx, bytes_processed, stats->test_count, stats->sample_count);
+    fprintf(file, ", \"min\": %.9g, \"max\": %.9g, \"mean\": %.9g, \"stddev\": %.9g", (f64)stats->min.time/freq, (f64)stats->max.time/freq, stats->mean/freq, stats->stddev/freq);
+    fprintf(file, ", \"median\": %.9g, \"median_ci_low\": %.9g, \"median_ci_high\": %.9g, \"p90\": %.9g, \"p99\": %.9g", stats->median/freq, stats->median_ci_low/freq, stats->median_ci_high/freq, stats->p90/freq, stats->p99/freq);
+    fprintf(file, ", \"min_page_faults\": %llu, \"min_major_page_faults\": %llu", stats->min.data.page_fault_count, stats->min.data.major_page_fault_count);
+    fprintf(file, ", \"avg_page_faults\": %.4f, \"avg_major_page_faults\": %.4f", (f64)stats->sum.data.page_fault_count/test_count, (f64)stats->sum.data.major_page_fault_count/test_count);
+    
+    if (rep_tester->environment.has_perf_counters && (stats->thread_count == 1))
+    {
+        // NOTE(achal): Per repetition, of the fastest one and averaged over all.
+        fprintf(file, ", \"min_counters\": {");
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            fprintf(file, "%s\"%s\": %llu", i ? ", " : "", g_PerfCounterNames[i], stats->min.data.perf_counters[i]);
+        fprintf(file, "}, \"avg_counters\": {");
+        for (u32 i = 0; i < PerfCounter_Count; ++i)
+            fprintf(file, "%s\"%s\": %.4f", i ? ", " : "", g_PerfCounterNames[i], (f64)stats->sum.data.perf_counters[i]/test_count);
+        fprintf(file, "}");
+    }
+    
+    if (stats->has_checksum)
+        fprintf(file, ", \"checksum\": \"%016llx\", \"checksum_mismatches\": %llu", stats->checksum, stats->checksum_mismatch_count);
+    
+    if (stats->thread_count > 1)
+    {
+        fprintf(file, ", \"thread_min\": [");
+        for (u32 thread_idx = 0; thread_idx < stats->thread_count; ++thread_idx)
+            fprintf(file, "%s%.9g", thread_idx ? ", " : "", (f64)stats->thread_min_time[thread_idx]/freq);
+        fprintf(file, "]");
+    }
+    
+    fprintf(file, "}");
+}
+
+static b32 ReadJSONString(char const *line, char const *key, char *buffer, u32 buffer_size)
+{
+    char const *value = strstr(line, key);
+    if (!value)
+        return 0;
+    
+    value = strchr(value + strlen(key), '"');
+    if (!value)
+        return 0;
+    ++value;
+    
+    u32 length = 0;
+    for (; *value && (*value != '"') && (length+1 < buffer_size); ++value)
+    {
+        if (*value == '\\')
+            ++value;
+        buffer[length++] = *value;
+    }
+    buffer[length] = '\0';
+    
+    return 1;
+}
+
+static b32 ReadJSONNumber(char const *line, char const *key, f64 *number)
+{
+    char const *value = strstr(line, key);
+    if (!value)
+        return 0;
+    
+    value = strchr(value + strlen(key), ':');
+    if (!value)
+        return 0;
+    
+    *number = strtod(value+1, 0);
+    return 1;
+}
+
+// NOTE(achal): Not a general JSON parser. It relies on WriteRepTestStatsJSON putting one result
+// object per line, much like haversine parses its input.
+static b32 LoadRepTestBaseline(RepTester *rep_tester, char const *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    
+    u64 file_size = GetFileSize(path);
+    char *contents = (char *)malloc(file_size+1);
+    if (!contents)
+    {
+        fclose(file);
+        return 0;
+    }
+    
+    u64 read_size = fread(contents, 1, file_size, file);
+    fclose(file);
+    if (read_size != file_size)
+    {
+        free(contents);
+        return 0;
+    }
+    contents[file_size] = '\0';
+    
+    u32 line_count = 1;
+    for (char *c = contents; *c; ++c)
+        line_count += (*c == '\n');
+    
+    rep_tester->baseline = (RepTestBaselineEntry *)calloc(line_count, sizeof(RepTestBaselineEntry));
+    rep_tester->baseline_count = 0;
+    
+    for (char *line = contents; line && *line;)
+    {
+        char *line_end = strchr(line, '\n');
+        if (line_end)
+            *line_end = '\0';
+        
+        RepTestBaselineEntry *entry = rep_tester->baseline + rep_tester->baseline_count;
+        if (ReadJSONString(line, "\"name\"", entry->name, sizeof(entry->name)) &&
+            ReadJSONString(line, "\"alloc_mode\"", entry->alloc_mode, sizeof(entry->alloc_mode)) &&
+            ReadJSONNumber(line, "\"median\"", &entry->median) &&
+            ReadJSONNumber(line, "\"median_ci_low\"", &entry->median_ci_low) &&
+            ReadJSONNumber(line, "\"median_ci_high\"", &entry->median_ci_high))
+        {
+            f64 thread_count = 1.0;
+            ReadJSONNumber(line, "\"threads\"", &thread_count);
+            entry->thread_count = (u32)thread_count;
+            
+            f64 repeat_idx = 0.0;
+            ReadJSONNumber(line, "\"repeat\"", &repeat_idx);
+            entry->repeat_idx = (u32)repeat_idx;
+            ++rep_tester->baseline_count;
+        }
+        
+        line = line_end ? line_end+1 : 0;
+    }
+    
+    free(contents);
+    return 1;
+}
+
+// NOTE(achal): A regression has to be both real and big enough to matter: the median's confidence
+// intervals of the two runs must not overlap, and the median must have moved by more than
+// regression_threshold. Either alone flags noise on tests with tight or wide spreads respectively.
+// With --repeat each repetition is compared against the same repetition of the baseline. The verdict is
+// printed to out.
+static void CompareRepTestWithBaseline(RepTester *rep_tester, char const *name, AllocationMode alloc_mode, RepTestStats *stats, FILE *out)
+{
+    RepTestBaselineEntry *entry = 0;
+    for (u32 i = 0; i < rep_tester->baseline_count; ++i)
+    {
+        RepTestBaselineEntry *candidate = rep_tester->baseline + i;
+        if ((strcmp(candidate->name, name) == 0) && (strcmp(candidate->alloc_mode, g_AllocationModeNames[alloc_mode]) == 0) && (candidate->thread_count == stats->thread_count) && (candidate->repeat_idx == rep_tester->repeat_idx))
+        {
+            entry = candidate;
+            break;
+        }
+    }
+    
+    if (!entry || (entry->median <= 0.0))
+    {
+        if (rep_tester->baseline)
+            fprintf(out, "Baseline: not found\n");
+        return;
+    }
+    
+    f64 freq = (f64)rep_tester->cpu_freq;
+    f64 median = stats->median/freq;
+    f64 ci_low = stats->median_ci_low/freq;
+    f64 ci_high = stats->median_ci_high/freq;
+    f64 change = (median - entry->median)/entry->median;
+    
+    char const *verdict = "within noise";
+    if ((ci_low > entry->median_ci_high) && (change > rep_tester->regression_threshold))
+    {
+        verdict = "REGRESSION";
+        ++rep_tester->regression_count;
+    }
+    else if ((ci_high < entry->median_ci_low) && (-change > rep_tester->regression_threshold))
+    {
+        verdict = "improvement";
+    }
+    
+    fprintf(out, "Baseline: median %.3f ms -> %.3f ms (%+.2f%%), %s\n", entry->median*1000.0, median*1000.0, change*100.0, verdict);
+}
+
+// NOTE(achal): Aggregate bandwidth per thread count, with the point where adding a thread stopped
+// buying at least 10% more marked as where the bus (DRAM, page cache, ...) saturates.
+static void PrintScalingTable(RepTester *rep_tester, u64 *median_times, u32 max_thread_count, u64 bytes_processed)
+{
+    f64 gigabytes = (f64)bytes_processed/(1024.0*1024.0*1024.0);
+    f64 single_gbps = gigabytes/((f64)median_times[1]/(f64)rep_tester->cpu_freq);
+    
+    printf("\nThreads, Aggregate GB/s (median), Per-thread GB/s, Speedup, Efficiency\n");
+    
+    b32 is_saturated = 0;
+    f64 prev_gbps = 0.0;
+    for (u32 thread_count = 1; thread_count <= max_thread_count; ++thread_count)
+    {
+        if (!median_times[thread_count])
+            continue;
+        
+        f64 gbps = gigabytes/((f64)median_times[thread_count]/(f64)rep_tester->cpu_freq);
+        f64 speedup = gbps/single_gbps;
+        printf("%7u, %24.3f, %15.3f, %7.2f, %9.1f%%", thread_count, gbps, gbps/thread_count, speedup, 100.0*speedup/thread_count);
+        
+        if (!is_saturated && (thread_count > 1) && (gbps < 1.1*prev_gbps))
+        {
+            printf("  <- saturates");
+            is_saturated = 1;
+        }
+        printf("\n");
+        
+        if (gbps > prev_gbps)
+            prev_gbps = gbps;
+    }
+}
+
+static void RunTest(RepTester *rep_tester, TestFunction *test_function, TestParams *test_params)
+{
+    // NOTE(achal): Too big for the stack.
+    static RepTestStats stats;
+    
+    u32 max_thread_count = rep_tester->config.max_thread_count;
+    if (!test_function->is_sliced && (max_thread_count > 1))
+    {
+        printf("\n%s can't be split across threads, running it single threaded only\n", test_function->name);
+        max_thread_count = 1;
+    }
+    
+    for (u32 alloc_mode = 0; alloc_mode < AllocationMode_Count; ++alloc_mode)
+    {
+        if (!(rep_tester->config.alloc_mode_mask & (1u << alloc_mode)))
+            continue;
+        
+        u64 median_times[REP_TESTER_MAX_THREADS+1] = {};
+        u64 bytes_processed = rep_tester->reuse_buffer.size;
+        
+        for (u32 thread_count = 1; thread_count <= max_thread_count; ++thread_count)
+        {
+            printf("\n--------%s", test_function->name);
+            if (alloc_mode != AllocationMode_None)
+                printf(" + %s", g_AllocationModeNames[alloc_mode]);
+            if (max_thread_count > 1)
+                printf(", %u thread%s", thread_count, (thread_count > 1) ? "s" : "");
+            printf("--------\n");
+            
+            if (!RunTestWithAllocationMode(rep_tester, test_function, test_params, (AllocationMode)alloc_mode, thread_count, &stats))
+            {
+                printf("Skipped, allocation mode not supported here\n");
+                break;
+            }
+            
+            if (stats.bytes_processed)
+                bytes_processed = stats.bytes_processed;
+            
+            median_times[thread_count] = (u64)stats.median;
+            if (g_RepTestResultCount < REP_TESTER_MAX_RESULTS)
+            {
+                RepTestResult *result = g_RepTestResults + g_RepTestResultCount++;
+                result->name = test_function->name;
+                result->alloc_mode = (AllocationMode)alloc_mode;
+                result->thread_count = thread_count;
+                result->repeat_idx = rep_tester->repeat_idx;
+                result->bytes_processed = bytes_processed;
+                result->median = stats.median;
+                result->avg_page_fault_count = (f64)stats.sum.data.page_fault_count/(f64)stats.test_count;
+            }
+            
+            if (stats.checksum_mismatch_count)
+                ++rep_tester->checksum_mismatch_count;
+            PrintRepTestStats(rep_tester, &stats, bytes_processed);
+            
+            if (rep_tester->json_file)
+                WriteRepTestStatsJSON(rep_tester, test_function->name, (AllocationMode)alloc_mode, &stats, bytes_processed);
+            
+            CompareRepTestWithBaseline(rep_tester, test_function->name, (AllocationMode)alloc_mode, &stats, stdout);
+        }
+        
+        if ((max_thread_count > 1) && median_times[1])
+            PrintScalingTable(rep_tester, median_times, max_thread_count, bytes_processed);
+    }
+}
+
+// NOTE(achal): '*' matches any run of characters, '?' any single one.
+static b32 MatchesGlob(char const *pattern, char const *string)
+{
+    if (*pattern == '\0')
+        return (*string == '\0');
+    
+    if (*pattern == '*')
+        return MatchesGlob(pattern+1, string) || ((*string != '\0') && MatchesGlob(pattern, string+1));
+    
+    if ((*string != '\0') && ((*pattern == '?') || (*pattern == *string)))
+        return MatchesGlob(pattern+1, string+1);
+    
+    return 0;
+}
+
+static b32 IsRepTestSelected(RepTesterConfig *config, TestFunction *test_function)
+{
+    b32 result = !config->filter || MatchesGlob(config->filter, test_function->name);
+    return result;
+}
+
+// NOTE(achal): Accepts plain byte counts as well as K, M and G suffixes (powers of 1024).
+static u64 ParseSize(char const *string)
+{
+    char *end = 0;
+    u64 result = strtoull(string, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': result *= 1024ull; break;
+        case 'm': case 'M': result *= 1024ull*1024; break;
+        case 'g': case 'G': result *= 1024ull*1024*1024; break;
+    }
+    return result;
+}
+
+static b32 ParseAllocationModes(char const *string, u32 *mask)
+{
+    *mask = 0;
+    while (*string)
+    {
+        char const *end = strchr(string, ',');
+        u64 length = end ? (u64)(end - string) : strlen(string);
+        
+        b32 found = 0;
+        if ((length == 3) && (strncmp(string, "all", 3) == 0))
+        {
+            *mask = (1u << AllocationMode_Count) - 1;
+            found = 1;
+        }
+        
+        for (u32 alloc_mode = 0; alloc_mode < AllocationMode_Count; ++alloc_mode)
+        {
+            char const *name = g_AllocationModeNames[alloc_mode];
+            if ((strlen(name) == length) && (strncmp(name, string, length) == 0))
+            {
+                *mask |= (1u << alloc_mode);
+                found = 1;
+            }
+        }
+        
+        if (!found)
+            return 0;
+        
+        string += length;
+        if (*string == ',')
+            ++string;
+    }
+    
+    return (*mask != 0);
+}
+
+static void PrintRepTesterUsage(char const *program, RepTesterConfig *config)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --filter <glob>          Only run tests whose name matches, e.g. \"fread*\"\n");
+    fprintf(stderr, "  --list                   Print the test names and exit\n");
+    fprintf(stderr, "  --seconds <s>            Stop once no new minimum was seen for this long (%.1f)\n", config->seconds);
+    fprintf(stderr, "  --size <bytes>[K|M|G]    Size of the test buffer\n");
+    fprintf(stderr, "  --input <path>           Input file, for tests that read one\n");
+    fprintf(stderr, "  --alloc-modes <a,b,..>   Allocation modes to run (none,malloc), or \"all\":");
+    for (u32 alloc_mode = 0; alloc_mode < AllocationMode_Count; ++alloc_mode)
+        fprintf(stderr, " %s", g_AllocationModeNames[alloc_mode]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  --threads <n>            Also run each test on 2..n threads, each on its own slice of the buffer\n");
+    fprintf(stderr, "  --repeat <n>             Run the selected tests n times\n");
+    fprintf(stderr, "  --checksum               Hash each test's output buffer and check it's the same every repetition\n");
+    fprintf(stderr, "  --counters               Read hardware counters (cycles, instructions, cache/TLB/branch misses), Linux only\n");
+    fprintf(stderr, "  --max-tests <n>          Stop a test after n repetitions\n");
+    fprintf(stderr, "  --ci-width <percent>     Stop a test once the median's 95%% CI is this narrow\n");
+    fprintf(stderr, "  --pin-cpu <n>            Pin the test thread to CPU n (default: the CPU it starts on)\n");
+    fprintf(stderr, "  --no-pin                 Don't pin the test thread\n");
+    fprintf(stderr, "  --high-priority          Raise the test thread's scheduling priority\n");
+    fprintf(stderr, "  --warmup <s>             Longest warmup before testing, 0 to skip it (%.1f)\n", config->max_warmup_seconds);
+    fprintf(stderr, "  --json <path>            Write results to path\n");
+    fprintf(stderr, "  --baseline <path>        Compare against results written with --json, exit code 1 on regressions\n");
+    fprintf(stderr, "  --threshold <percent>    Smallest median change that counts as a regression (%.1f)\n", config->regression_threshold*100.0);
+}
+
+static b32 ParseRepTesterCommandLine(int argc, char **argv, RepTesterConfig *config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        char *arg = argv[i];
+        char *value = (i+1 < argc) ? argv[i+1] : 0;
+        
+        b32 consumed_value = 1;
+        if (strcmp(arg, "--list") == 0)
+        {
+            config->list_only = 1;
+            consumed_value = 0;
+        }
+        else if (strcmp(arg, "--checksum") == 0)
+        {
+            config->checksum_outputs = 1;
+            consumed_value = 0;
+        }
+        else if (strcmp(arg, "--counters") == 0)
+        {
+            config->perf_counters = 1;
+            consumed_value = 0;
+        }
+        else if (strcmp(arg, "--no-pin") == 0)
+        {
+            config->no_pin = 1;
+            consumed_value = 0;
+        }
+        else if (strcmp(arg, "--high-priority") == 0)
+        {
+            config->high_priority = 1;
+            consumed_value = 0;
+        }
+        else if (!value)
+        {
+            PrintRepTesterUsage(argv[0], config);
+            return 0;
+        }
+        else if (strcmp(arg, "--filter") == 0)
+        {
+            config->filter = value;
+        }
+        else if (strcmp(arg, "--seconds") == 0)
+        {
+            config->seconds = atof(value);
+        }
+        else if (strcmp(arg, "--size") == 0)
+        {
+            config->size = ParseSize(value);
+        }
+        else if (strcmp(arg, "--input") == 0)
+        {
+            config->input = value;
+        }
+        else if (strcmp(arg, "--alloc-modes") == 0)
+        {
+            if (!ParseAllocationModes(value, &config->alloc_mode_mask))
+            {
+                fprintf(stderr, "ERROR: Unknown allocation mode in: %s\n", value);
+                return 0;
+            }
+        }
+        else if (strcmp(arg, "--threads") == 0)
+        {
+            config->max_thread_count = (u32)atoi(value);
+        }
+        else if (strcmp(arg, "--repeat") == 0)
+        {
+            config->repeat_count = (u32)atoi(value);
+        }
+        else if (strcmp(arg, "--max-tests") == 0)
+        {
+            config->max_test_count = strtoull(value, 0, 10);
+        }
+        else if (strcmp(arg, "--ci-width") == 0)
+        {
+            config->target_ci_width = atof(value)/100.0;
+        }
+        else if (strcmp(arg, "--pin-cpu") == 0)
+        {
+            config->pin_cpu = atoi(value);
+        }
+        else if (strcmp(arg, "--warmup") == 0)
+        {
+            config->max_warmup_seconds = atof(value);
+        }
+        else if (strcmp(arg, "--json") == 0)
+        {
+            config->json_path = value;
+        }
+        else if (strcmp(arg, "--baseline") == 0)
+        {
+            config->baseline_path = value;
+        }
+        else if (strcmp(arg, "--threshold") == 0)
+        {
+            config->regression_threshold = atof(value)/100.0;
+        }
+        else
+        {
+            PrintRepTesterUsage(argv[0], config);
+            return 0;
+        }
+        
+        if (consumed_value)
+            ++i;
+    }
+    
+    if ((config->seconds <= 0.0) || !config->repeat_count || !config->max_thread_count || (config->max_thread_count > REP_TESTER_MAX_THREADS))
+    {
+        PrintRepTesterUsage(argv[0], config);
+        return 0;
+    }
+    
+    return 1;
+}
+
+// NOTE(achal): Loads the baseline and opens the JSON output, if the config asks for them.
+static b32 BeginRepTestReport(RepTester *rep_tester)
+{
+    RepTesterConfig *config = &rep_tester->config;
+    if (config->list_only)
+        return 1;
+    
+    if (config->baseline_path && !LoadRepTestBaseline(rep_tester, config->baseline_path))
+    {
+        fprintf(stderr, "ERROR: Failed to read baseline %s\n", config->baseline_path);
+        return 0;
+    }
+    
+    if (config->json_path)
+    {
+        rep_tester->json_file = fopen(config->json_path, "wb");
+        if (!rep_tester->json_file)
+        {
+            fprintf(stderr, "ERROR: Failed to open %s for writing\n", config->json_path);
+            return 0;
+        }
+        
+        MachineInfo machine = GetMachineInfo();
+        FILE *file = rep_tester->json_file;
+        fprintf(file, "{\n\"machine\": {\"os\": \"%s\", \"cpu\": ", machine.os);
+        WriteJSONString(file, machine.cpu_brand);
+        fprintf(file, ", \"logical_processors\": %u, \"page_size\": %llu", machine.logical_processor_count, machine.page_size);
+        fprintf(file, ", \"cpu_timer_frequency\": %llu, \"cpu_timer_source\": \"%s\", \"cpu_timer_invariant\": %s},\n", machine.cpu_timer_frequency, machine.cpu_timer_source, machine.is_cpu_timer_invariant ? "true" : "false");
+        
+        RepTestEnvironment *environment = &rep_tester->environment;
+        fprintf(file, "\"environment\": {\"pinned_cpu\": %d, \"high_priority\": %s, \"governor\": ", environment->pinned_cpu, environment->is_high_priority ? "true" : "false");
+        WriteJSONString(file, environment->governor);
+        fprintf(file, ", \"turbo\": %d, \"warmup_settled\": %s, \"warmup_seconds\": %.6f, \"timer_overhead\": %.9g},\n", environment->turbo, environment->is_warmup_settled ? "true" : "false", environment->warmup_seconds, (f64)environment->timer_overhead/(f64)rep_tester->cpu_freq);
+        
+        fprintf(file, "\"results\": [\n");
+    }
+    
+    return 1;
+}
+
+// NOTE(achal): Runs (or with --list, just prints) the tests which pass the filter, repeat_count times.
+static void RunTests(RepTester *rep_tester, TestFunction *test_functions, u32 test_function_count, TestParams *test_params)
+{
+    RepTesterConfig *config = &rep_tester->config;
+    
+    for (u32 repeat_idx = 0; repeat_idx < config->repeat_count; ++repeat_idx)
+    {
+        rep_tester->repeat_idx = repeat_idx;
+        
+        for (u32 fn_idx = 0; fn_idx < test_function_count; ++fn_idx)
+        {
+            TestFunction *test_function = test_functions + fn_idx;
+            if (!IsRepTestSelected(config, test_function))
+                continue;
+            
+            if (config->list_only)
+                printf("%s\n", test_function->name);
+            else
+                RunTest(rep_tester, test_function, test_params);
+        }
+        
+        if (config->list_only)
+            break;
+    }
+}
+
+// NOTE(achal): Returns the process exit code: non-zero if any test regressed against the baseline, or had
+// mismatched checksums.
+static int EndRepTester(RepTester *rep_tester)
+{
+    if (rep_tester->json_file)
+    {
+        fprintf(rep_tester->json_file, "\n]\n}\n");
+        fclose(rep_tester->json_file);
+        rep_tester->json_file = 0;
+    }
+    
+    int result = 0;
+    if (rep_tester->checksum_mismatch_count)
+    {
+        printf("\n%u test(s) didn't produce the same output every repetition\n", rep_tester->checksum_mismatch_count);
+        result = 1;
+    }
+    
+    if (rep_tester->baseline)
+    {
+        if (rep_tester->regression_count)
+        {
+            printf("\n%u test(s) regressed against the baseline\n", rep_tester->regression_count);
+            result = 1;
+        }
+        
+        free(rep_tester->baseline);
+        rep_tester->baseline = 0;
+    }
+    
+    if (rep_tester->environment.has_perf_counters)
+        ShutdownPerfCounters();
+    
+    return result;
+}
+
+/*
+NOTE(achal):
+Sweeps, for programs which run their tests over a parameter of their own (a working set size, a chunk size,
+a ring depth, ...) and print their own table rather than RunTests' report:
+
+    RepTesterConfig config = DefaultRepTesterConfig(...);
+    if (!ParseRepTestSweepCommandLine(argc, argv, &config))
+        return -1;
+    if (config.list_only)
+        return ListRepTests(&config);
+    
+    ... // set up the reuse buffer from the config
+    
+    RepTester rep_tester;
+    if (!BeginRepTestSweep(&rep_tester, &config, &reuse_buffer))
+        return -1;
+    
+    for (each selected test, each point of the sweep)
+        RunRepTestSweepPoint(&rep_tester, test_function, &test_params, "<point>", &stats);
+    
+    return EndRepTester(&rep_tester);
+
+Every point runs on the pre-touched reuse buffer, single threaded, once, so --alloc-modes, --threads and
+--repeat are rejected. --json writes one result per point, named <test>/<point>, and --baseline compares
+against those, with the verdicts on stderr so that the table on stdout stays clean.
+*/
+static b32 ParseRepTestSweepCommandLine(int argc, char **argv, RepTesterConfig *config)
+{
+    config->alloc_mode_mask = 0;
+    if (!ParseRepTesterCommandLine(argc, argv, config))
+        return 0;
+    
+    if ((config->alloc_mode_mask & ~(1u << AllocationMode_None)) || (config->max_thread_count > 1) || (config->repeat_count > 1))
+    {
+        fprintf(stderr, "ERROR: %s sweeps its own parameter, --alloc-modes, --threads and --repeat aren't supported\n", argv[0]);
+        return 0;
+    }
+    
+    config->alloc_mode_mask = (1u << AllocationMode_None);
+    return 1;
+}
+
+static int ListRepTests(RepTesterConfig *config)
+{
+    for (u32 fn_idx = 0; fn_idx < g_RepTestCount; ++fn_idx)
+    {
+        if (IsRepTestSelected(config, g_RepTests + fn_idx))
+            printf("%s\n", g_RepTests[fn_idx].name);
+    }
+    
+    return 0;
+}
+
+static b32 BeginRepTestSweep(RepTester *rep_tester, RepTesterConfig *config, Buffer *reuse_buffer)
+{
+    *rep_tester = MakeRepTester(config, reuse_buffer);
+    rep_tester->is_interactive = 0;
+    
+    b32 result = BeginRepTestReport(rep_tester);
+    return result;
+}
+
+// NOTE(achal): point names the point of the sweep in the JSON and the baseline, e.g. the size.
+static void RunRepTestSweepPoint(RepTester *rep_tester, TestFunction *test_function, TestParams *test_params, char const *point, RepTestStats *stats)
+{
+    RunTestWithAllocationMode(rep_tester, test_function, test_params, AllocationMode_None, 1, stats);
+    if (stats->checksum_mismatch_count)
+        ++rep_tester->checksum_mismatch_count;
+    
+    char name[128];
+    snprintf(name, sizeof(name), "%s/%s", test_function->name, point);
+    u64 bytes_processed = stats->bytes_processed ? stats->bytes_processed : rep_tester->reuse_buffer.size;
+    
+    if (rep_tester->json_file)
+        WriteRepTestStatsJSON(rep_tester, name, AllocationMode_None, stats, bytes_processed);
+    
+    if (rep_tester->baseline)
+    {
+        fprintf(stderr, "%s: ", name);
+        CompareRepTestWithBaseline(rep_tester, name, AllocationMode_None, stats, stderr);
+    }
+}
+
+// NOTE(achal): The main of REP_TEST_MAIN.
+static int RepTestMain(int argc, char **argv, RepTesterConfig *config, RepTestSetupProc *setup, TestParams *test_params)
+{
+    if (!ParseRepTesterCommandLine(argc, argv, config))
+        return -1;
+    
+    Buffer reuse_buffer = {};
+    if (!config->list_only && setup && !setup(config, test_params, &reuse_buffer))
+        return -1;
+    
+    RepTester rep_tester = MakeRepTester(config, &reuse_buffer);
+    if (!BeginRepTestReport(&rep_tester))
+        return -1;
+    
+    RunTests(&rep_tester, g_RepTests, g_RepTestCount, test_params);
+    
+    return EndRepTester(&rep_tester);
 }
 
 #endif // REP_TESTER_H